@@ -0,0 +1,54 @@
+#ifndef CARD_DATA_H
+#define CARD_DATA_H
+
+#include <string>
+#include <vector>
+
+namespace ygo {
+
+struct CardData {
+	unsigned int code;
+	unsigned int alias;
+	unsigned long long setcode;
+	unsigned int type;
+	unsigned int level;
+	unsigned int attribute;
+	unsigned int race;
+	int attack;
+	int defense;
+	unsigned int lscale;
+	unsigned int rscale;
+	unsigned int link_marker;
+};
+struct CardDataC {
+	unsigned int code;
+	unsigned int alias;
+	unsigned long long setcode;
+	unsigned int type;
+	unsigned int level;
+	unsigned int attribute;
+	unsigned int race;
+	int attack;
+	int defense;
+	unsigned int lscale;
+	unsigned int rscale;
+	unsigned int link_marker;
+	unsigned int ot;
+	unsigned int category;
+};
+struct CardString {
+	std::wstring name;
+	std::wstring text;
+	std::wstring desc[16];
+};
+// offsets of a card's texts in the string arena of CardStore
+struct CardText {
+	unsigned int name;
+	unsigned int text;
+	unsigned int desc[16];
+};
+typedef std::vector<std::pair<unsigned int, CardDataC>>::const_iterator code_pointer;
+
+}
+
+#endif //CARD_DATA_H
@@ -0,0 +1,127 @@
+#include "card_index.h"
+#include "data_manager.h"
+#include <algorithm>
+#include <iterator>
+
+namespace ygo {
+
+// sorted keys of the trigrams of str
+static void GetKeys(const wchar_t* str, bool normalize, std::vector<unsigned int>& keys) {
+	keys.clear();
+	unsigned long long window = 0;
+	for(size_t i = 0; str[i]; ++i) {
+		wchar_t c = normalize ? CardIndex::NormalizeChar(str[i]) : str[i];
+		window = ((window << 21) | ((unsigned long long)c & 0x1fffff)) & 0x7fffffffffffffffULL;
+		if(i < 2)
+			continue;
+		// different trigrams may share a key, which only adds candidates
+		keys.push_back((unsigned int)((window * 0x9e3779b97f4a7c15ULL) >> 32) % CARD_INDEX_KEYS);
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+void CardIndex::Build() {
+	std::vector<unsigned long long> name_entries;
+	std::vector<unsigned long long> text_entries;
+	std::vector<unsigned int> keys;
+	columns = CardColumns();
+	unsigned int card = 0;
+	for(code_pointer ptr = dataManager._datas.begin(); ptr != dataManager._datas.end(); ++ptr, ++card) {
+		const CardDataC& data = ptr->second;
+		columns.code.push_back(ptr->first);
+		columns.type.push_back(data.type);
+		columns.race.push_back(data.race);
+		columns.attribute.push_back(data.attribute);
+		columns.attack.push_back(data.attack);
+		columns.defense.push_back(data.defense);
+		columns.level.push_back(data.level);
+		columns.lscale.push_back(data.lscale);
+		columns.link_marker.push_back(data.link_marker);
+		columns.category.push_back(data.category);
+		columns.ot.push_back(data.ot);
+		const CardText& text = dataManager._datas.GetText(ptr);
+		GetKeys(dataManager._datas.GetString(text.name), true, keys);
+		for(auto kit = keys.begin(); kit != keys.end(); ++kit)
+			name_entries.push_back(((unsigned long long)*kit << 32) | card);
+		GetKeys(dataManager._datas.GetString(text.text), false, keys);
+		for(auto kit = keys.begin(); kit != keys.end(); ++kit)
+			text_entries.push_back(((unsigned long long)*kit << 32) | card);
+	}
+	names.Build(name_entries);
+	texts.Build(text_entries);
+	card_count = dataManager._datas.size();
+}
+bool CardIndex::IsBuilt() const {
+	return card_count == dataManager._datas.size();
+}
+void CardIndex::SetAll(CardMask& mask) const {
+	mask.assign((card_count + 63) / 64, ~0ULL);
+	if(card_count & 63)
+		mask.back() = (1ULL << (card_count & 63)) - 1;
+}
+bool CardIndex::FindName(const wchar_t* keyword, std::vector<unsigned int>& cards) const {
+	return names.Find(keyword, true, cards);
+}
+bool CardIndex::FindText(const wchar_t* keyword, std::vector<unsigned int>& cards) const {
+	return texts.Find(keyword, false, cards);
+}
+wchar_t CardIndex::NormalizeChar(wchar_t c) {
+	/*
+	// Convert all symbols and punctuations to space.
+	if (c != 0 && c < 128 && !isalnum(c)) {
+		return ' ';
+	}
+	*/
+	// Convert latin chararacters to uppercase to ignore case.
+	if (c < 128 && isalpha(c)) {
+		return toupper(c);
+	}
+	// Remove some accentued characters that are not supported by the editbox.
+	if (c >= 232 && c <= 235) {
+		return 'E';
+	}
+	if (c >= 238 && c <= 239) {
+		return 'I';
+	}
+	return c;
+}
+void CardIndex::Trigrams::Build(const std::vector<unsigned long long>& entries) {
+	// counting sort by key; entries come in card order, so each key keeps its cards sorted
+	starts.assign(CARD_INDEX_KEYS + 1, 0);
+	for(auto eit = entries.begin(); eit != entries.end(); ++eit)
+		starts[(*eit >> 32) + 1]++;
+	for(size_t k = 0; k < CARD_INDEX_KEYS; ++k)
+		starts[k + 1] += starts[k];
+	std::vector<unsigned int> next(starts.begin(), starts.end() - 1);
+	cards.resize(entries.size());
+	for(auto eit = entries.begin(); eit != entries.end(); ++eit)
+		cards[next[*eit >> 32]++] = (unsigned int)*eit;
+}
+bool CardIndex::Trigrams::Find(const wchar_t* keyword, bool normalize, std::vector<unsigned int>& found) const {
+	std::vector<unsigned int> query;
+	GetKeys(keyword, normalize, query);
+	if(query.empty() || starts.empty())
+		return false;
+	found.clear();
+	// smallest posting list first, so the intersection only shrinks from there
+	std::vector<std::pair<unsigned int, unsigned int>> ranges;
+	for(auto qit = query.begin(); qit != query.end(); ++qit) {
+		if(starts[*qit] == starts[*qit + 1])
+			return true;
+		ranges.emplace_back(starts[*qit], starts[*qit + 1]);
+	}
+	std::sort(ranges.begin(), ranges.end(), [](const std::pair<unsigned int, unsigned int>& a, const std::pair<unsigned int, unsigned int>& b) {
+		return a.second - a.first < b.second - b.first;
+	});
+	found.assign(cards.begin() + ranges[0].first, cards.begin() + ranges[0].second);
+	std::vector<unsigned int> merged;
+	for(size_t r = 1; r < ranges.size() && !found.empty(); ++r) {
+		merged.clear();
+		std::set_intersection(found.begin(), found.end(), cards.begin() + ranges[r].first, cards.begin() + ranges[r].second, std::back_inserter(merged));
+		found.swap(merged);
+	}
+	return true;
+}
+
+}
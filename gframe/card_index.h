@@ -0,0 +1,80 @@
+#ifndef CARD_INDEX_H
+#define CARD_INDEX_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace ygo {
+
+// trigrams are hashed into this many keys
+#define CARD_INDEX_KEYS		0x100000
+
+// one bit per card, set for the cards a search keeps
+typedef std::vector<unsigned long long> CardMask;
+
+// the fields the deck builder filters on, one array per field
+struct CardColumns {
+	std::vector<unsigned int> code;
+	std::vector<unsigned int> type;
+	std::vector<unsigned int> race;
+	std::vector<unsigned int> attribute;
+	std::vector<int> attack;
+	std::vector<int> defense;
+	std::vector<unsigned int> level;
+	std::vector<unsigned int> lscale;
+	std::vector<unsigned int> link_marker;
+	std::vector<unsigned int> category;
+	std::vector<unsigned int> ot;
+};
+
+// Card fields and trigram index of the card names and texts, for the deck
+// builder search. Cards are numbered by their position in DataManager::_datas.
+// Names are indexed after NormalizeChar, texts as they are. A card found for
+// a keyword only may contain it and still has to be checked.
+class CardIndex {
+public:
+	CardIndex(): card_count(0) {}
+	void Build();
+	bool IsBuilt() const;
+	size_t GetCount() const { return card_count; }
+	void SetAll(CardMask& mask) const;
+	// clears the bits of the cards whose field fails pred
+	template<typename T, typename Pred>
+	static void Filter(CardMask& mask, const std::vector<T>& column, Pred pred) {
+		for(size_t w = 0; w < mask.size(); ++w) {
+			if(!mask[w])
+				continue;
+			size_t base = w * 64;
+			size_t count = column.size() - base < 64 ? column.size() - base : 64;
+			unsigned long long bits = 0;
+			for(size_t b = 0; b < count; ++b)
+				bits |= (unsigned long long)(pred(column[base + b]) ? 1 : 0) << b;
+			mask[w] &= bits;
+		}
+	}
+	static bool IsSet(const CardMask& mask, size_t card) {
+		return (mask[card >> 6] >> (card & 63)) & 1;
+	}
+	// false if the keyword is too short to narrow the search
+	bool FindName(const wchar_t* keyword, std::vector<unsigned int>& cards) const;
+	bool FindText(const wchar_t* keyword, std::vector<unsigned int>& cards) const;
+	static wchar_t NormalizeChar(wchar_t c);
+
+	CardColumns columns;
+
+private:
+	struct Trigrams {
+		std::vector<unsigned int> starts;	// cards of key k are cards[starts[k]] to cards[starts[k + 1]]
+		std::vector<unsigned int> cards;
+		void Build(const std::vector<unsigned long long>& entries);
+		bool Find(const wchar_t* keyword, bool normalize, std::vector<unsigned int>& found) const;
+	};
+
+	Trigrams names;
+	Trigrams texts;
+	size_t card_count;
+};
+
+}
+
+#endif //CARD_INDEX_H
@@ -117,33 +117,29 @@ void ClientField::Initial(int player, int deckc, int extrac) {
 		GetCardLocation(pcard, &pcard->curPos, &pcard->curRot, true);
 	}
 }
-ClientCard* ClientField::GetCard(int controler, int location, int sequence, int sub_seq) {
-	std::vector<ClientCard*>* lst = 0;
-	bool is_xyz = (location & 0x80) != 0;
-	location &= 0x7f;
+std::vector<ClientCard*>* ClientField::GetList(int controler, int location) {
 	switch(location) {
 	case LOCATION_DECK:
-		lst = &deck[controler];
-		break;
+		return &deck[controler];
 	case LOCATION_HAND:
-		lst = &hand[controler];
-		break;
+		return &hand[controler];
 	case LOCATION_MZONE:
-		lst = &mzone[controler];
-		break;
+		return &mzone[controler];
 	case LOCATION_SZONE:
-		lst = &szone[controler];
-		break;
+		return &szone[controler];
 	case LOCATION_GRAVE:
-		lst = &grave[controler];
-		break;
+		return &grave[controler];
 	case LOCATION_REMOVED:
-		lst = &remove[controler];
-		break;
+		return &remove[controler];
 	case LOCATION_EXTRA:
-		lst = &extra[controler];
-		break;
+		return &extra[controler];
 	}
+	return 0;
+}
+ClientCard* ClientField::GetCard(int controler, int location, int sequence, int sub_seq) {
+	bool is_xyz = (location & 0x80) != 0;
+	location &= 0x7f;
+	std::vector<ClientCard*>* lst = GetList(controler, location);
 	if(!lst)
 		return 0;
 	if(is_xyz) {
@@ -304,30 +300,7 @@ void ClientField::UpdateCard(int controler, int location, int sequence, char* da
 		pcard->UpdateInfo(data + 4);
 }
 void ClientField::UpdateFieldCard(int controler, int location, char* data) {
-	std::vector<ClientCard*>* lst = 0;
-	switch(location) {
-	case LOCATION_DECK:
-		lst = &deck[controler];
-		break;
-	case LOCATION_HAND:
-		lst = &hand[controler];
-		break;
-	case LOCATION_MZONE:
-		lst = &mzone[controler];
-		break;
-	case LOCATION_SZONE:
-		lst = &szone[controler];
-		break;
-	case LOCATION_GRAVE:
-		lst = &grave[controler];
-		break;
-	case LOCATION_REMOVED:
-		lst = &remove[controler];
-		break;
-	case LOCATION_EXTRA:
-		lst = &extra[controler];
-		break;
-	}
+	std::vector<ClientCard*>* lst = GetList(controler, location);
 	if(!lst)
 		return;
 	int len;
@@ -338,6 +311,21 @@ void ClientField::UpdateFieldCard(int controler, int location, char* data) {
 		data += len - 4;
 	}
 }
+void ClientField::UpdateFieldDelta(int controler, int location, char* data, int len) {
+	std::vector<ClientCard*>* lst = GetList(controler, location);
+	if(!lst)
+		return;
+	char* end = data + len;
+	while(end - data > 4) {
+		unsigned int seq = BufferIO::ReadUInt8(data);
+		int clen = BufferIO::ReadInt32(data);
+		if(clen < 4 || clen - 4 > end - data)
+			return;
+		if(clen > 8 && seq < lst->size() && (*lst)[seq])
+			(*lst)[seq]->UpdateInfo(data);
+		data += clen - 4;
+	}
+}
 void ClientField::ClearCommandFlag() {
 	for(auto cit = activatable_cards.begin(); cit != activatable_cards.end(); ++cit)
 		(*cit)->cmdFlag = 0;
@@ -1444,16 +1432,16 @@ void ClientField::UpdateDeclarableList() {
 	}
 	mainGame->lstANCard->clear();
 	ancard.clear();
-	for(auto cit = dataManager._strings.begin(); cit != dataManager._strings.end(); ++cit) {
-		if(cit->second.name.find(pname) != std::wstring::npos) {
-			auto cp = dataManager.GetCodePointer(cit->first);	//verified by _strings
+	for(auto cit = dataManager._datas.begin(); cit != dataManager._datas.end(); ++cit) {
+		const wchar_t* name = dataManager._datas.GetString(dataManager._datas.GetText(cit).name);
+		if(wcsstr(name, pname)) {
 			//datas.alias can be double card names or alias
-			if(is_declarable(cp->second, declare_opcodes)) {
-				if(pname == cit->second.name) { //exact match
-					mainGame->lstANCard->insertItem(0, cit->second.name.c_str(), -1);
+			if(is_declarable(cit->second, declare_opcodes)) {
+				if(!wcscmp(pname, name)) { //exact match
+					mainGame->lstANCard->insertItem(0, name, -1);
 					ancard.insert(ancard.begin(), cit->first);
 				} else {
-					mainGame->lstANCard->addItem(cit->second.name.c_str());
+					mainGame->lstANCard->addItem(name);
 					ancard.push_back(cit->first);
 				}
 			}
@@ -86,10 +86,12 @@ public:
 	void Clear();
 	void Initial(int player, int deckc, int extrac);
 	ClientCard* GetCard(int controler, int location, int sequence, int sub_seq = 0);
+	std::vector<ClientCard*>* GetList(int controler, int location);
 	void AddCard(ClientCard* pcard, int controler, int location, int sequence);
 	ClientCard* RemoveCard(int controler, int location, int sequence);
 	void UpdateCard(int controler, int location, int sequence, char* data);
 	void UpdateFieldCard(int controler, int location, char* data);
+	void UpdateFieldDelta(int controler, int location, char* data, int len);
 	void ClearCommandFlag();
 	void ClearSelect();
 	void ClearChainSelect();
@@ -3,8 +3,12 @@
 
 #pragma once
 
+#ifdef YGOPRO_SERVER_MODE
+#undef XDG_ENVIRONMENT
+#else
 #define _IRR_STATIC_LIB_
 #define IRR_COMPILE_WITH_DX9_DEV_PACK
+#endif
 #ifdef _WIN32
 
 #include <WinSock2.h>
@@ -54,6 +58,7 @@ template<size_t N, typename... TR>
 inline int myswprintf(wchar_t(&buf)[N], const wchar_t* fmt, TR... args) {
 	return swprintf(buf, N, fmt, args...);
 }
+#ifndef YGOPRO_SERVER_MODE
 #include <irrlicht.h>
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
@@ -64,6 +69,8 @@ inline int myswprintf(wchar_t(&buf)[N], const wchar_t* fmt, TR... args) {
 #endif //__APPLE__
 #include "CGUITTFont.h"
 #include "CGUIImageButton.h"
+#endif //YGOPRO_SERVER_MODE
+#include <string>
 #include <iostream>
 #include <sstream>
 #include <stdio.h>
@@ -89,12 +96,14 @@ inline void path_foreach(const std::basic_string<CharT>& path, CharT pathSep,
 		cb(dir);
 }
 
+#ifndef YGOPRO_SERVER_MODE
 using namespace irr;
 using namespace core;
 using namespace scene;
 using namespace video;
 using namespace io;
 using namespace gui;
+#endif //YGOPRO_SERVER_MODE
 
 extern const unsigned short PRO_VERSION;
 extern int enable_log;
@@ -102,5 +111,8 @@ extern bool exit_on_return;
 extern bool open_file;
 extern wchar_t open_file_name[256];
 extern bool bot_mode;
+#ifdef YGOPRO_SERVER_MODE
+extern bool prefer_expansion_script;
+#endif
 
 #endif
@@ -1,16 +1,234 @@
 #include "data_manager.h"
+#include "startup_profile.h"
+#ifndef YGOPRO_SERVER_MODE
 #include "game.h"
+#endif
 #include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
 
 namespace ygo {
 
 const wchar_t* DataManager::unknown_string = L"???";
 wchar_t DataManager::strBuffer[4096];
-byte DataManager::scriptBuffer[0x20000];
+thread_local byte DataManager::scriptBuffer[0x20000];
+#ifndef YGOPRO_SERVER_MODE
 IFileSystem* DataManager::FileSystem;
+#endif
 DataManager dataManager;
 
+#define CARD_CACHE_ID		0x63647963
+// bump when LoadDB reads the columns differently
+#define CARD_CACHE_VERSION	1
+
+// followed by count CardDataC, count CardText and arena_size wchar_t
+struct CardCacheHeader {
+	unsigned int id;
+	unsigned int version;
+	unsigned int data_size;
+	unsigned int char_size;
+	unsigned long long source_hash;
+	unsigned int count;
+	unsigned int arena_size;
+};
+
+CardStore::CardStore(): interned(0, ArenaHash{ &arena }, ArenaEqual{ &arena }) {
+	// offset 0 is the empty string
+	arena.push_back(0);
+	sorted = 0;
+	committed_arena = arena.size();
+}
+code_pointer CardStore::find(unsigned int code) const {
+	auto cit = std::lower_bound(datas.begin(), datas.end(), code, [](const std::pair<unsigned int, CardDataC>& card, unsigned int code) {
+		return card.first < code;
+	});
+	if(cit == datas.end() || cit->first != code)
+		return datas.end();
+	return cit;
+}
+unsigned int CardStore::Intern(const wchar_t* str) {
+	if(!str[0])
+		return 0;
+	unsigned int offset = (unsigned int)arena.size();
+	arena.insert(arena.end(), str, str + wcslen(str) + 1);
+	auto sit = interned.find(offset);
+	if(sit != interned.end()) {
+		arena.resize(offset);
+		return *sit;
+	}
+	interned.insert(offset);
+	return offset;
+}
+void CardStore::Add(const CardDataC& data, const CardText& text) {
+	datas.emplace_back(data.code, data);
+	texts.push_back(text);
+}
+// Adds every card of a store that was never committed, such as one a database
+// was parsed into on another thread.
+void CardStore::Append(const CardStore& staged) {
+	unsigned int base = (unsigned int)arena.size() - 1;
+	arena.insert(arena.end(), staged.arena.begin() + 1, staged.arena.end());
+	for(size_t i = 0; i < staged.datas.size(); ++i) {
+		CardText text = staged.texts[i];
+		if(text.name)
+			text.name += base;
+		if(text.text)
+			text.text += base;
+		for(int j = 0; j < 16; ++j) {
+			if(text.desc[j])
+				text.desc[j] += base;
+		}
+		Add(staged.datas[i].second, text);
+	}
+}
+// Sorts the cards added since the last commit in. A code that is already
+// there keeps the card loaded first.
+void CardStore::Commit() {
+	interned = std::unordered_set<unsigned int, ArenaHash, ArenaEqual>(0, ArenaHash{ &arena }, ArenaEqual{ &arena });
+	if(sorted == datas.size()) {
+		committed_arena = arena.size();
+		return;
+	}
+	std::vector<size_t> order(datas.size());
+	for(size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [this](size_t lhs, size_t rhs) {
+		return datas[lhs].first < datas[rhs].first;
+	});
+	std::vector<std::pair<unsigned int, CardDataC>> new_datas;
+	std::vector<CardText> new_texts;
+	new_datas.reserve(datas.size());
+	new_texts.reserve(texts.size());
+	for(auto i : order) {
+		if(!new_datas.empty() && new_datas.back().first == datas[i].first)
+			continue;
+		new_datas.push_back(datas[i]);
+		new_texts.push_back(texts[i]);
+	}
+	datas.swap(new_datas);
+	texts.swap(new_texts);
+	arena.shrink_to_fit();
+	sorted = datas.size();
+	committed_arena = arena.size();
+}
+// The cards added since the last commit and the strings they interned, with
+// the offsets made relative to the string just before them.
+bool CardStore::SaveAdded(FILE* fp, unsigned long long source_hash) const {
+	CardCacheHeader cheader;
+	cheader.id = CARD_CACHE_ID;
+	cheader.version = CARD_CACHE_VERSION;
+	cheader.data_size = sizeof(CardDataC);
+	cheader.char_size = sizeof(wchar_t);
+	cheader.source_hash = source_hash;
+	cheader.count = (unsigned int)(datas.size() - sorted);
+	cheader.arena_size = (unsigned int)(arena.size() - committed_arena + 1);
+	unsigned int base = (unsigned int)committed_arena - 1;
+	std::vector<CardDataC> cache_datas;
+	std::vector<CardText> cache_texts;
+	for(size_t i = sorted; i < datas.size(); ++i) {
+		cache_datas.push_back(datas[i].second);
+		CardText text = texts[i];
+		if(text.name)
+			text.name -= base;
+		if(text.text)
+			text.text -= base;
+		for(int j = 0; j < 16; ++j) {
+			if(text.desc[j])
+				text.desc[j] -= base;
+		}
+		cache_texts.push_back(text);
+	}
+	if(fwrite(&cheader, sizeof(cheader), 1, fp) != 1)
+		return false;
+	if(cheader.count && (fwrite(cache_datas.data(), sizeof(CardDataC), cheader.count, fp) != cheader.count
+	        || fwrite(cache_texts.data(), sizeof(CardText), cheader.count, fp) != cheader.count))
+		return false;
+	return fwrite(&arena[base], sizeof(wchar_t), cheader.arena_size, fp) == cheader.arena_size;
+}
+bool CardStore::LoadAdded(FILE* fp, unsigned long long source_hash) {
+	CardCacheHeader cheader;
+	if(fread(&cheader, sizeof(cheader), 1, fp) != 1 || cheader.id != CARD_CACHE_ID || cheader.version != CARD_CACHE_VERSION
+	        || cheader.data_size != sizeof(CardDataC) || cheader.char_size != sizeof(wchar_t)
+	        || cheader.source_hash != source_hash || cheader.arena_size == 0)
+		return false;
+	std::vector<CardDataC> cache_datas(cheader.count);
+	std::vector<CardText> cache_texts(cheader.count);
+	std::vector<wchar_t> cache_arena(cheader.arena_size);
+	if(cheader.count && (fread(cache_datas.data(), sizeof(CardDataC), cheader.count, fp) != cheader.count
+	        || fread(cache_texts.data(), sizeof(CardText), cheader.count, fp) != cheader.count))
+		return false;
+	if(fread(cache_arena.data(), sizeof(wchar_t), cheader.arena_size, fp) != cheader.arena_size || cache_arena.back() != 0)
+		return false;
+	unsigned int base = (unsigned int)arena.size() - 1;
+	for(auto& text : cache_texts) {
+		if(text.name >= cheader.arena_size || text.text >= cheader.arena_size)
+			return false;
+		if(text.name)
+			text.name += base;
+		if(text.text)
+			text.text += base;
+		for(int j = 0; j < 16; ++j) {
+			if(text.desc[j] >= cheader.arena_size)
+				return false;
+			if(text.desc[j])
+				text.desc[j] += base;
+		}
+	}
+	arena.insert(arena.end(), cache_arena.begin() + 1, cache_arena.end());
+	for(unsigned int i = 0; i < cheader.count; ++i)
+		Add(cache_datas[i], cache_texts[i]);
+	return true;
+}
+size_t CardStore::ArenaHash::operator()(unsigned int offset) const {
+	size_t hash = 2166136261u;
+	for(const wchar_t* p = &(*arena)[offset]; *p; ++p)
+		hash = (hash ^ (size_t)*p) * 16777619u;
+	return hash;
+}
+bool CardStore::ArenaEqual::operator()(unsigned int lhs, unsigned int rhs) const {
+	return !wcscmp(&(*arena)[lhs], &(*arena)[rhs]);
+}
+
 bool DataManager::LoadDB(const char* file) {
+	return QueueDB(file) && LoadQueuedDBs();
+}
+bool DataManager::LoadDB(const wchar_t* wfile) {
+	return QueueDB(wfile) && LoadQueuedDBs();
+}
+#ifdef YGOPRO_SERVER_MODE
+bool DataManager::QueueDB(const char* file) {
+#ifdef _WIN32
+	wchar_t wfile[256];
+	BufferIO::DecodeUTF8(file, wfile);
+	FILE* fp = _wfopen(wfile, L"rb");
+#else
+	FILE* fp = fopen(file, "rb");
+#endif
+	if(!fp)
+		return false;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if(size < 0) {
+		fclose(fp);
+		return false;
+	}
+	spmembuffer_t* mem = (spmembuffer_t*)calloc(sizeof(spmembuffer_t), 1);
+	mem->data = (char*)malloc(size + 1);
+	mem->total = mem->used = fread(mem->data, 1, size, fp);
+	fclose(fp);
+	(mem->data)[mem->total] = '\0';
+	return QueueDB(file, mem);
+}
+bool DataManager::QueueDB(const wchar_t* wfile) {
+	char file[256];
+	BufferIO::EncodeUTF8(wfile, file);
+	return QueueDB(file);
+}
+#else
+bool DataManager::QueueDB(const char* file) {
 #ifdef _WIN32
 	char wfile[256];
 	BufferIO::DecodeUTF8(file, wfile);
@@ -18,10 +236,10 @@ bool DataManager::LoadDB(const char* file) {
 #else
 	IReadFile* reader = FileSystem->createAndOpenFile(file);
 #endif
-	return LoadDB(file, reader);
+	return QueueDB(file, reader);
 }
 
-bool DataManager::LoadDB(const wchar_t* wfile) {
+bool DataManager::QueueDB(const wchar_t* wfile) {
 	char file[256];
 	BufferIO::EncodeUTF8(wfile, file);
 #ifdef _WIN32
@@ -29,21 +247,78 @@ bool DataManager::LoadDB(const wchar_t* wfile) {
 #else
 	IReadFile* reader = FileSystem->createAndOpenFile(file);
 #endif
-	return LoadDB(file, reader);
+	return QueueDB(file, reader);
 }
 
-bool DataManager::LoadDB(const char* file, IReadFile* reader) {
+bool DataManager::QueueDB(const char* file, IReadFile* reader) {
 	if(reader == NULL)
 		return false;
-	spmemvfs_db_t db;
 	spmembuffer_t* mem = (spmembuffer_t*)calloc(sizeof(spmembuffer_t), 1);
-	spmemvfs_env_init();
 	mem->total = mem->used = reader->getSize();
 	mem->data = (char*)malloc(mem->total + 1);
 	reader->read(mem->data, mem->total);
 	reader->drop();
 	(mem->data)[mem->total] = '\0';
-	if(spmemvfs_open_db(&db, file, mem) != SQLITE_OK)
+	return QueueDB(file, mem);
+}
+#endif //YGOPRO_SERVER_MODE
+bool DataManager::QueueDB(const char* file, spmembuffer_t* mem) {
+	queued_dbs.push_back(std::make_pair(std::string(file), mem));
+	return true;
+}
+// Every queued database is parsed on its own thread into a store of its own.
+// They are merged in queue order, so a card queued first still wins.
+bool DataManager::LoadQueuedDBs() {
+	size_t count = queued_dbs.size();
+	std::vector<std::unique_ptr<CardStore>> staged(count);
+	std::vector<char> results(count, 0);
+	for(size_t i = 0; i < count; ++i)
+		staged[i].reset(new CardStore());
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		size_t i;
+		while((i = next++) < count)
+			results[i] = ParseDB(i, queued_dbs[i].first.c_str(), queued_dbs[i].second, *staged[i]);
+	};
+	size_t threads = std::min<size_t>(std::thread::hardware_concurrency(), count);
+	ProfileScope phase("parse databases");
+	spmemvfs_env_init();
+	if(threads <= 1) {
+		worker();
+	} else {
+		std::vector<std::thread> workers;
+		for(size_t t = 0; t < threads; ++t)
+			workers.emplace_back(worker);
+		for(auto& thread : workers)
+			thread.join();
+	}
+	spmemvfs_env_fini();
+	phase.Next("merge databases");
+	queued_dbs.clear();
+	bool result = true;
+	for(size_t i = 0; i < count; ++i) {
+		_datas.Append(*staged[i]);
+		if(!results[i])
+			result = false;
+	}
+	_datas.Commit();
+	phase.End();
+	return result;
+}
+bool DataManager::ParseDB(size_t index, const char* file, spmembuffer_t* mem, CardStore& cards) const {
+	unsigned long long source_hash = 0xcbf29ce484222325ULL;
+	for(int i = 0; i < mem->used; ++i)
+		source_hash = (source_hash ^ (unsigned char)mem->data[i]) * 0x100000001b3ULL;
+	if(LoadCache(source_hash, cards)) {
+		free(mem->data);
+		free(mem);
+		return true;
+	}
+	// spmemvfs finds the buffer by name, which has to be unique among the queued ones
+	std::string path = std::to_string(index) + ":" + file;
+	wchar_t textBuffer[4096];
+	spmemvfs_db_t db;
+	if(spmemvfs_open_db(&db, path.c_str(), mem) != SQLITE_OK)
 		return Error(&db);
 	sqlite3* pDB = db.handle;
 	sqlite3_stmt* pStmt;
@@ -51,7 +326,7 @@ bool DataManager::LoadDB(const char* file, IReadFile* reader) {
 	if(sqlite3_prepare_v2(pDB, sql, -1, &pStmt, 0) != SQLITE_OK)
 		return Error(&db);
 	CardDataC cd;
-	CardString cs;
+	CardText ct;
 	int step = 0;
 	do {
 		step = sqlite3_step(pStmt);
@@ -77,29 +352,64 @@ bool DataManager::LoadDB(const char* file, IReadFile* reader) {
 			cd.race = sqlite3_column_int(pStmt, 8);
 			cd.attribute = sqlite3_column_int(pStmt, 9);
 			cd.category = sqlite3_column_int(pStmt, 10);
-			_datas.insert(std::make_pair(cd.code, cd));
+			ct.name = 0;
 			if(const char* text = (const char*)sqlite3_column_text(pStmt, 12)) {
-				BufferIO::DecodeUTF8(text, strBuffer);
-				cs.name = strBuffer;
+				BufferIO::DecodeUTF8(text, textBuffer);
+				ct.name = cards.Intern(textBuffer);
 			}
+			ct.text = 0;
 			if(const char* text = (const char*)sqlite3_column_text(pStmt, 13)) {
-				BufferIO::DecodeUTF8(text, strBuffer);
-				cs.text = strBuffer;
+				BufferIO::DecodeUTF8(text, textBuffer);
+				ct.text = cards.Intern(textBuffer);
 			}
 			for(int i = 0; i < 16; ++i) {
+				ct.desc[i] = 0;
 				if(const char* text = (const char*)sqlite3_column_text(pStmt, i + 14)) {
-					BufferIO::DecodeUTF8(text, strBuffer);
-					cs.desc[i] = strBuffer;
+					BufferIO::DecodeUTF8(text, textBuffer);
+					ct.desc[i] = cards.Intern(textBuffer);
 				}
 			}
-			_strings.emplace(cd.code, cs);
+			cards.Add(cd, ct);
 		}
 	} while(step != SQLITE_DONE);
+	SaveCache(source_hash, cards);
 	sqlite3_finalize(pStmt);
 	spmemvfs_close_db(&db);
-	spmemvfs_env_fini();
 	return true;
 }
+static std::string CacheFile(const std::string& cache_path, unsigned long long source_hash) {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.cache", source_hash);
+	return cache_path + name;
+}
+bool DataManager::LoadCache(unsigned long long source_hash, CardStore& cards) const {
+	if(cache_path.empty())
+		return false;
+	FILE* fp = fopen(CacheFile(cache_path, source_hash).c_str(), "rb");
+	if(!fp)
+		return false;
+	bool result = cards.LoadAdded(fp, source_hash);
+	fclose(fp);
+	return result;
+}
+// Written under a temporary name first, so another process starting at the
+// same time never reads half a cache.
+void DataManager::SaveCache(unsigned long long source_hash, const CardStore& cards) const {
+	if(cache_path.empty())
+		return;
+	if(!::FileSystem::IsDirExists(cache_path.c_str()) && !::FileSystem::MakeDir(cache_path.c_str()))
+		return;
+	std::string file = CacheFile(cache_path, source_hash);
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%x.tmp", (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id()));
+	std::string temp_file = file + suffix;
+	FILE* fp = fopen(temp_file.c_str(), "wb");
+	if(!fp)
+		return;
+	bool result = cards.SaveAdded(fp, source_hash);
+	if(fclose(fp) != 0 || !result || rename(temp_file.c_str(), file.c_str()) != 0)
+		remove(temp_file.c_str());
+}
 bool DataManager::LoadStrings(const char* file) {
 	FILE* fp = fopen(file, "r");
 	if(!fp)
@@ -113,6 +423,7 @@ bool DataManager::LoadStrings(const char* file) {
 		myswprintf(numStrings[i], L"%d", i);
 	return true;
 }
+#ifndef YGOPRO_SERVER_MODE
 bool DataManager::LoadStrings(IReadFile* reader) {
 	char ch[2] = " ";
 	char linebuf[256] = "";
@@ -128,6 +439,7 @@ bool DataManager::LoadStrings(IReadFile* reader) {
 	reader->drop();
 	return true;
 }
+#endif //YGOPRO_SERVER_MODE
 void DataManager::ReadStringConfLine(const char* linebuf) {
 	if(linebuf[0] != '!')
 		return;
@@ -153,11 +465,9 @@ void DataManager::ReadStringConfLine(const char* linebuf) {
 	}
 }
 bool DataManager::Error(spmemvfs_db_t* pDB, sqlite3_stmt* pStmt) {
-	BufferIO::DecodeUTF8(sqlite3_errmsg(pDB->handle), strBuffer);
 	if(pStmt)
 		sqlite3_finalize(pStmt);
 	spmemvfs_close_db(pDB);
-	spmemvfs_env_fini();
 	return false;
 }
 bool DataManager::GetData(int code, CardData* pData) {
@@ -172,29 +482,35 @@ code_pointer DataManager::GetCodePointer(int code) {
 	return _datas.find(code);
 }
 bool DataManager::GetString(int code, CardString* pStr) {
-	auto csit = _strings.find(code);
-	if(csit == _strings.end()) {
+	auto cdit = _datas.find(code);
+	if(cdit == _datas.end()) {
 		pStr->name = unknown_string;
 		pStr->text = unknown_string;
 		return false;
 	}
-	*pStr = csit->second;
+	const CardText& text = _datas.GetText(cdit);
+	pStr->name = _datas.GetString(text.name);
+	pStr->text = _datas.GetString(text.text);
+	for(int i = 0; i < 16; ++i)
+		pStr->desc[i] = _datas.GetString(text.desc[i]);
 	return true;
 }
 const wchar_t* DataManager::GetName(int code) {
-	auto csit = _strings.find(code);
-	if(csit == _strings.end())
+	auto cdit = _datas.find(code);
+	if(cdit == _datas.end())
 		return unknown_string;
-	if(!csit->second.name.empty())
-		return csit->second.name.c_str();
+	const wchar_t* name = _datas.GetString(_datas.GetText(cdit).name);
+	if(name[0])
+		return name;
 	return unknown_string;
 }
 const wchar_t* DataManager::GetText(int code) {
-	auto csit = _strings.find(code);
-	if(csit == _strings.end())
+	auto cdit = _datas.find(code);
+	if(cdit == _datas.end())
 		return unknown_string;
-	if(!csit->second.text.empty())
-		return csit->second.text.c_str();
+	const wchar_t* text = _datas.GetString(_datas.GetText(cdit).text);
+	if(text[0])
+		return text;
 	return unknown_string;
 }
 const wchar_t* DataManager::GetDesc(int strCode) {
@@ -202,11 +518,12 @@ const wchar_t* DataManager::GetDesc(int strCode) {
 		return GetSysString(strCode);
 	int code = strCode >> 4;
 	int offset = strCode & 0xf;
-	auto csit = _strings.find(code);
-	if(csit == _strings.end())
+	auto cdit = _datas.find(code);
+	if(cdit == _datas.end())
 		return unknown_string;
-	if(!csit->second.desc[offset].empty())
-		return csit->second.desc[offset].c_str();
+	const wchar_t* desc = _datas.GetString(_datas.GetText(cdit).desc[offset]);
+	if(desc[0])
+		return desc;
 	return unknown_string;
 }
 const wchar_t* DataManager::GetSysString(int code) {
@@ -383,7 +700,11 @@ byte* DataManager::ScriptReaderEx(const char* script_name, int* slen) {
 	// default script name: ./script/c%d.lua
 	char first[256];
 	char second[256];
+#ifdef YGOPRO_SERVER_MODE
+	if(prefer_expansion_script) {
+#else
 	if(mainGame->gameConf.prefer_expansion_script) {
+#endif
 		sprintf(first, "expansions/%s", script_name + 2);
 		sprintf(second, "%s", script_name + 2);
 	} else {
@@ -397,6 +718,24 @@ byte* DataManager::ScriptReaderEx(const char* script_name, int* slen) {
 #endif
 }
 byte* DataManager::ScriptReader(const char* script_name, int* slen) {
+#ifdef YGOPRO_SERVER_MODE
+#ifdef _WIN32
+	wchar_t fname[256];
+	BufferIO::DecodeUTF8(script_name, fname);
+	FILE* fp = _wfopen(fname, L"rb");
+#else
+	FILE* fp = fopen(script_name, "rb");
+#endif
+	if(!fp)
+		return 0;
+	size_t size = fread(scriptBuffer, 1, sizeof(scriptBuffer), fp);
+	bool overflow = size == sizeof(scriptBuffer) && fgetc(fp) != EOF;
+	fclose(fp);
+	if(overflow)
+		return 0;
+	*slen = size;
+	return scriptBuffer;
+#else
 #ifdef _WIN32
 	wchar_t fname[256];
 	BufferIO::DecodeUTF8(script_name, fname);
@@ -415,6 +754,7 @@ byte* DataManager::ScriptReader(const char* script_name, int* slen) {
 	reader->drop();
 	*slen = size;
 	return scriptBuffer;
+#endif //YGOPRO_SERVER_MODE
 }
 
 }
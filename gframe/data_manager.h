@@ -4,22 +4,76 @@
 #include "config.h"
 #include "sqlite3.h"
 #include "spmemvfs/spmemvfs.h"
-#include "client_card.h"
+#include "card_data.h"
 #include <unordered_map>
+#include <unordered_set>
 
 namespace ygo {
 
+// The cards sorted by code. Their texts share one arena in which every distinct
+// string is stored once, and a card only keeps the offsets of its texts.
+class CardStore {
+public:
+	CardStore();
+	CardStore(const CardStore&) = delete;
+	CardStore& operator=(const CardStore&) = delete;
+	code_pointer begin() const { return datas.begin(); }
+	code_pointer end() const { return datas.end(); }
+	code_pointer find(unsigned int code) const;
+	size_t size() const { return datas.size(); }
+	const CardText& GetText(code_pointer cp) const { return texts[cp - datas.begin()]; }
+	const wchar_t* GetString(unsigned int offset) const { return &arena[offset]; }
+	unsigned int Intern(const wchar_t* str);
+	void Add(const CardDataC& data, const CardText& text);
+	void Append(const CardStore& staged);
+	void Commit();
+	bool SaveAdded(FILE* fp, unsigned long long source_hash) const;
+	bool LoadAdded(FILE* fp, unsigned long long source_hash);
+
+private:
+	struct ArenaHash {
+		const std::vector<wchar_t>* arena;
+		size_t operator()(unsigned int offset) const;
+	};
+	struct ArenaEqual {
+		const std::vector<wchar_t>* arena;
+		bool operator()(unsigned int lhs, unsigned int rhs) const;
+	};
+
+	std::vector<std::pair<unsigned int, CardDataC>> datas;
+	std::vector<CardText> texts;
+	std::vector<wchar_t> arena;
+	// offsets of the strings interned by the database being loaded
+	std::unordered_set<unsigned int, ArenaHash, ArenaEqual> interned;
+	size_t sorted;
+	// arena size at the last commit
+	size_t committed_arena;
+};
+
 class DataManager {
 private:
-	bool LoadDB(const char* file, IReadFile* reader);
+	bool QueueDB(const char* file, spmembuffer_t* mem);
+#ifndef YGOPRO_SERVER_MODE
+	bool QueueDB(const char* file, IReadFile* reader);
+#endif
+	bool ParseDB(size_t index, const char* file, spmembuffer_t* mem, CardStore& cards) const;
+	bool LoadCache(unsigned long long source_hash, CardStore& cards) const;
+	void SaveCache(unsigned long long source_hash, const CardStore& cards) const;
+
+	std::vector<std::pair<std::string, spmembuffer_t*>> queued_dbs;
 public:
-	DataManager(): _datas(8192), _strings(8192) {}
 	bool LoadDB(const char* file);
 	bool LoadDB(const wchar_t* wfile);
+	// reads the file now and parses it in the next LoadQueuedDBs
+	bool QueueDB(const char* file);
+	bool QueueDB(const wchar_t* wfile);
+	bool LoadQueuedDBs();
 	bool LoadStrings(const char* file);
+#ifndef YGOPRO_SERVER_MODE
 	bool LoadStrings(IReadFile* reader);
+#endif
 	void ReadStringConfLine(const char* linebuf);
-	bool Error(spmemvfs_db_t* pDB, sqlite3_stmt* pStmt = 0);
+	static bool Error(spmemvfs_db_t* pDB, sqlite3_stmt* pStmt = 0);
 	bool GetData(int code, CardData* pData);
 	code_pointer GetCodePointer(int code);
 	bool GetString(int code, CardString* pStr);
@@ -39,8 +93,9 @@ public:
 	const wchar_t* FormatSetName(unsigned long long setcode);
 	const wchar_t* FormatLinkMarker(int link_marker);
 
-	std::unordered_map<unsigned int, CardDataC> _datas;
-	std::unordered_map<unsigned int, CardString> _strings;
+	CardStore _datas;
+	// parsed databases are kept here by content hash, empty to disable
+	std::string cache_path = "./cache";
 	std::unordered_map<unsigned int, std::wstring> _counterStrings;
 	std::unordered_map<unsigned int, std::wstring> _victoryStrings;
 	std::unordered_map<unsigned int, std::wstring> _setnameStrings;
@@ -55,12 +110,14 @@ public:
 	wchar_t lmBuffer[32];
 
 	static wchar_t strBuffer[4096];
-	static byte scriptBuffer[0x20000];
+	static thread_local byte scriptBuffer[0x20000];
 	static const wchar_t* unknown_string;
 	static int CardReader(int, void*);
 	static byte* ScriptReaderEx(const char* script_name, int* slen);
 	static byte* ScriptReader(const char* script_name, int* slen);
+#ifndef YGOPRO_SERVER_MODE
 	static IFileSystem* FileSystem;
+#endif
 };
 
 extern DataManager dataManager;
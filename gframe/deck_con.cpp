@@ -57,6 +57,67 @@ static bool check_set_code(const CardDataC& data, int set_code) {
 	}
 	return res;
 }
+// cards named exactly pstr first, then the rest by sort_type
+static void SortCards(std::vector<code_pointer>& cards, const wchar_t* pstr, int sort_type) {
+	auto left = cards.begin();
+	for(auto it = cards.begin(); it != cards.end(); ++it) {
+		if(wcscmp(pstr, dataManager.GetName((*it)->first)) == 0) {
+			std::iter_swap(left, it);
+			++left;
+		}
+	}
+	switch(sort_type) {
+	case 0:
+		std::sort(left, cards.end(), ClientCard::deck_sort_lv);
+		break;
+	case 1:
+		std::sort(left, cards.end(), ClientCard::deck_sort_atk);
+		break;
+	case 2:
+		std::sort(left, cards.end(), ClientCard::deck_sort_def);
+		break;
+	case 3:
+		std::sort(left, cards.end(), ClientCard::deck_sort_name);
+		break;
+	}
+}
+// ATK and DEF below 0 are unknown, -2 is "?"; level and scale are never unknown
+static bool IsUnknownStat(int value) {
+	return value < 0;
+}
+static bool IsUnknownStat(unsigned int value) {
+	return false;
+}
+static bool IsQuestionStat(int value) {
+	return value == -2;
+}
+static bool IsQuestionStat(unsigned int value) {
+	return false;
+}
+// keeps the cards whose stat passes a comparison from parse_filter
+template<typename T>
+static void FilterStat(CardMask& mask, const std::vector<T>& column, unsigned int op, T filter) {
+	switch(op) {
+	case 1:
+		CardIndex::Filter(mask, column, [filter](T value) { return value == filter; });
+		break;
+	case 2:
+		CardIndex::Filter(mask, column, [filter](T value) { return value >= filter; });
+		break;
+	case 3:
+		CardIndex::Filter(mask, column, [filter](T value) { return value > filter; });
+		break;
+	case 4:
+		CardIndex::Filter(mask, column, [filter](T value) { return value <= filter && !IsUnknownStat(value); });
+		break;
+	case 5:
+		CardIndex::Filter(mask, column, [filter](T value) { return value < filter && !IsUnknownStat(value); });
+		break;
+	case 6:
+		CardIndex::Filter(mask, column, [](T value) { return IsQuestionStat(value); });
+		break;
+	}
+}
 
 void DeckBuilder::Initialize() {
 	mainGame->is_building = true;
@@ -74,6 +135,7 @@ void DeckBuilder::Initialize() {
 	mainGame->btnSideSort->setVisible(false);
 	mainGame->btnSideReload->setVisible(false);
 	filterList = &deckManager._lfList[0].content;
+	UpdateIndex();
 	mainGame->cbDBLFList->setSelected(0);
 	ClearSearch();
 	mouse_pos.set(0, 0);
@@ -91,6 +153,7 @@ void DeckBuilder::Initialize() {
 }
 void DeckBuilder::Terminate() {
 	mainGame->is_building = false;
+	CancelSearch();
 	mainGame->ClearCardInfo();
 	mainGame->wDeckEdit->setVisible(false);
 	mainGame->wCategories->setVisible(false);
@@ -786,21 +849,11 @@ void DeckBuilder::StartFilter() {
 	FilterCards();
 }
 void DeckBuilder::FilterCards() {
-	results.clear();
-	struct element_t {
-		std::wstring keyword;
-		int setcode;
-		enum class type_t {
-			all,
-			name,
-			setcode
-		} type;
-		bool exclude;
-		element_t(): setcode(0), type(type_t::all), exclude(false) {}
-	};
-	const wchar_t* pstr = mainGame->ebCardName->getText();
-	std::wstring str = std::wstring(pstr);
-	std::vector<element_t> query_elements;
+	typedef SearchQuery::element_t element_t;
+	SearchQuery query;
+	query.text = mainGame->ebCardName->getText();
+	const std::wstring& str = query.text;
+	std::vector<element_t>& query_elements = query.elements;
 	if(mainGame->gameConf.search_multiple_keywords) {
 		const wchar_t separator = mainGame->gameConf.search_multiple_keywords == 1 ? L' ' : L'+';
 		const wchar_t minussign = L'-';
@@ -859,92 +912,164 @@ void DeckBuilder::FilterCards() {
 			query_elements.push_back(element);
 		}
 	}
-	auto strpointer = dataManager._strings.begin();
-	for(code_pointer ptr = dataManager._datas.begin(); ptr != dataManager._datas.end(); ++ptr, ++strpointer) {
-		const CardDataC& data = ptr->second;
-		const CardString& text = strpointer->second;
-		if(data.type & TYPE_TOKEN)
-			continue;
-		switch(filter_type) {
-		case 1: {
-			if(!(data.type & TYPE_MONSTER) || (data.type & filter_type2) != filter_type2)
-				continue;
-			if(filter_race && data.race != filter_race)
-				continue;
-			if(filter_attrib && data.attribute != filter_attrib)
-				continue;
-			if(filter_atktype) {
-				if((filter_atktype == 1 && data.attack != filter_atk) || (filter_atktype == 2 && data.attack < filter_atk)
-				        || (filter_atktype == 3 && data.attack <= filter_atk) || (filter_atktype == 4 && (data.attack > filter_atk || data.attack < 0))
-				        || (filter_atktype == 5 && (data.attack >= filter_atk || data.attack < 0)) || (filter_atktype == 6 && data.attack != -2))
-					continue;
-			}
-			if(filter_deftype) {
-				if((filter_deftype == 1 && data.defense != filter_def) || (filter_deftype == 2 && data.defense < filter_def)
-				        || (filter_deftype == 3 && data.defense <= filter_def) || (filter_deftype == 4 && (data.defense > filter_def || data.defense < 0))
-				        || (filter_deftype == 5 && (data.defense >= filter_def || data.defense < 0)) || (filter_deftype == 6 && data.defense != -2)
-				        || (data.type & TYPE_LINK))
-					continue;
-			}
-			if(filter_lvtype) {
-				if((filter_lvtype == 1 && data.level != filter_lv) || (filter_lvtype == 2 && data.level < filter_lv)
-				        || (filter_lvtype == 3 && data.level <= filter_lv) || (filter_lvtype == 4 && data.level > filter_lv)
-				        || (filter_lvtype == 5 && data.level >= filter_lv) || filter_lvtype == 6)
-					continue;
-			}
-			if(filter_scltype) {
-				if((filter_scltype == 1 && data.lscale != filter_scl) || (filter_scltype == 2 && data.lscale < filter_scl)
-				        || (filter_scltype == 3 && data.lscale <= filter_scl) || (filter_scltype == 4 && (data.lscale > filter_scl))
-				        || (filter_scltype == 5 && (data.lscale >= filter_scl)) || filter_scltype == 6
-				        || !(data.type & TYPE_PENDULUM))
-					continue;
-			}
-			break;
+	query.filter_effect = filter_effect;
+	query.filter_type = filter_type;
+	query.filter_type2 = filter_type2;
+	query.filter_attrib = filter_attrib;
+	query.filter_race = filter_race;
+	query.filter_atktype = filter_atktype;
+	query.filter_atk = filter_atk;
+	query.filter_deftype = filter_deftype;
+	query.filter_def = filter_def;
+	query.filter_lvtype = filter_lvtype;
+	query.filter_lv = filter_lv;
+	query.filter_scltype = filter_scltype;
+	query.filter_scl = filter_scl;
+	query.filter_marks = filter_marks;
+	query.filter_lm = filter_lm;
+	query.filterList = filterList;
+	query.sort_type = mainGame->cbSortType->getSelected();
+	UpdateIndex();
+	SubmitSearch(query);
+}
+bool DeckBuilder::RunSearch(const SearchQuery& query, std::vector<code_pointer>& found_cards) {
+	typedef SearchQuery::element_t element_t;
+	const std::vector<element_t>& query_elements = query.elements;
+	const CardColumns& columns = card_index.columns;
+	CardMask mask;
+	card_index.SetAll(mask);
+	CardIndex::Filter(mask, columns.type, [](unsigned int type) {
+		return !(type & TYPE_TOKEN);
+	});
+	switch(query.filter_type) {
+	case 1: {
+		unsigned int type2 = query.filter_type2;
+		CardIndex::Filter(mask, columns.type, [type2](unsigned int type) {
+			return (type & TYPE_MONSTER) && (type & type2) == type2;
+		});
+		if(query.filter_race) {
+			unsigned int race = query.filter_race;
+			CardIndex::Filter(mask, columns.race, [race](unsigned int value) {
+				return value == race;
+			});
 		}
-		case 2: {
-			if(!(data.type & TYPE_SPELL))
-				continue;
-			if(filter_type2 && data.type != filter_type2)
-				continue;
-			break;
+		if(query.filter_attrib) {
+			unsigned int attribute = query.filter_attrib;
+			CardIndex::Filter(mask, columns.attribute, [attribute](unsigned int value) {
+				return value == attribute;
+			});
 		}
-		case 3: {
-			if(!(data.type & TYPE_TRAP))
-				continue;
-			if(filter_type2 && data.type != filter_type2)
-				continue;
-			break;
+		if(query.filter_atktype)
+			FilterStat(mask, columns.attack, query.filter_atktype, query.filter_atk);
+		if(query.filter_deftype) {
+			FilterStat(mask, columns.defense, query.filter_deftype, query.filter_def);
+			CardIndex::Filter(mask, columns.type, [](unsigned int type) {
+				return !(type & TYPE_LINK);
+			});
 		}
+		if(query.filter_lvtype)
+			FilterStat(mask, columns.level, query.filter_lvtype, query.filter_lv);
+		if(query.filter_scltype) {
+			FilterStat(mask, columns.lscale, query.filter_scltype, query.filter_scl);
+			CardIndex::Filter(mask, columns.type, [](unsigned int type) {
+				return (type & TYPE_PENDULUM) != 0;
+			});
 		}
-		if(filter_effect && !(data.category & filter_effect))
-			continue;
-		if(filter_marks && (data.link_marker & filter_marks)!= filter_marks)
+		break;
+	}
+	case 2:
+	case 3: {
+		unsigned int type1 = query.filter_type == 2 ? TYPE_SPELL : TYPE_TRAP;
+		unsigned int type2 = query.filter_type2;
+		CardIndex::Filter(mask, columns.type, [type1, type2](unsigned int type) {
+			return (type & type1) && (!type2 || type == type2);
+		});
+		break;
+	}
+	}
+	if(query.filter_effect) {
+		long long effect = query.filter_effect;
+		CardIndex::Filter(mask, columns.category, [effect](unsigned int category) {
+			return (category & effect) != 0;
+		});
+	}
+	if(query.filter_marks) {
+		unsigned int marks = query.filter_marks;
+		CardIndex::Filter(mask, columns.link_marker, [marks](unsigned int link_marker) {
+			return (link_marker & marks) == marks;
+		});
+	}
+	if(query.filter_lm) {
+		if(query.filter_lm <= 3) {
+			const std::unordered_map<int, int>* list = query.filterList;
+			int count = query.filter_lm - 1;
+			CardIndex::Filter(mask, columns.code, [list, count](unsigned int code) {
+				auto lit = list->find(code);
+				return lit != list->end() && lit->second == count;
+			});
+		} else if(query.filter_lm <= 7) {
+			unsigned int ot = query.filter_lm - 3;
+			CardIndex::Filter(mask, columns.ot, [ot](unsigned int value) {
+				return value == ot;
+			});
+		}
+	}
+	// only the cards the index finds for every keyword that has to match
+	std::vector<unsigned int> candidates;
+	bool use_candidates = false;
+	std::vector<unsigned int> found;
+	std::vector<unsigned int> found_text;
+	std::vector<unsigned int> merged;
+	for(auto elements_iterator = query_elements.begin(); elements_iterator != query_elements.end(); ++elements_iterator) {
+		if(elements_iterator->exclude)
 			continue;
-		if(filter_lm) {
-			if(filter_lm <= 3 && (!filterList->count(ptr->first) || (*filterList).at(ptr->first) != filter_lm - 1))
+		const wchar_t* keyword = elements_iterator->keyword.c_str();
+		if(elements_iterator->type == element_t::type_t::name) {
+			if(!card_index.FindName(keyword, found))
 				continue;
-			if(filter_lm == 4 && data.ot != 1)
+		} else if(elements_iterator->type == element_t::type_t::all) {
+			if(elements_iterator->setcode || dataManager.GetData(BufferIO::GetVal(keyword), 0))
 				continue;
-			if(filter_lm == 5 && data.ot != 2)
-				continue;
-			if(filter_lm == 6 && data.ot != 3)
-				continue;
-			if(filter_lm == 7 && data.ot != 4)
+			if(!card_index.FindName(keyword, found) || !card_index.FindText(keyword, found_text))
 				continue;
+			merged.clear();
+			std::set_union(found.begin(), found.end(), found_text.begin(), found_text.end(), std::back_inserter(merged));
+			found.swap(merged);
+		} else
+			continue;
+		if(use_candidates) {
+			merged.clear();
+			std::set_intersection(candidates.begin(), candidates.end(), found.begin(), found.end(), std::back_inserter(merged));
+			candidates.swap(merged);
+		} else {
+			candidates.swap(found);
+			use_candidates = true;
 		}
+	}
+	size_t card_count = use_candidates ? candidates.size() : card_index.GetCount();
+	for(size_t i = 0; i < card_count; ++i) {
+		if(!(i & 0xff) && query.generation != search_generation)
+			return false;
+		size_t card = use_candidates ? candidates[i] : i;
+		if(!CardIndex::IsSet(mask, card))
+			continue;
+		code_pointer ptr = dataManager._datas.begin() + card;
+		const CardDataC& data = ptr->second;
+		const CardText& text = dataManager._datas.GetText(ptr);
+		const wchar_t* name = dataManager._datas.GetString(text.name);
 		bool is_target = true;
 		for (auto elements_iterator = query_elements.begin(); elements_iterator != query_elements.end(); ++elements_iterator) {
 			bool match = false;
 			if (elements_iterator->type == element_t::type_t::name) {
-				match = CardNameContains(text.name.c_str(), elements_iterator->keyword.c_str());
+				match = CardNameContains(name, elements_iterator->keyword.c_str());
 			} else if (elements_iterator->type == element_t::type_t::setcode) {
 				match = elements_iterator->setcode && check_set_code(data, elements_iterator->setcode);
 			} else {
 				int trycode = BufferIO::GetVal(elements_iterator->keyword.c_str());
 				bool tryresult = dataManager.GetData(trycode, 0);
 				if(!tryresult) {
-					match = CardNameContains(text.name.c_str(), elements_iterator->keyword.c_str())
-						|| text.text.find(elements_iterator->keyword) != std::wstring::npos
+					match = CardNameContains(name, elements_iterator->keyword.c_str())
+						|| wcsstr(dataManager._datas.GetString(text.text), elements_iterator->keyword.c_str())
 						|| (elements_iterator->setcode && check_set_code(data, elements_iterator->setcode));
 				} else {
 					match = data.code == trycode || data.alias == trycode;
@@ -958,10 +1083,69 @@ void DeckBuilder::FilterCards() {
 			}
 		}
 		if(is_target)
-			results.push_back(ptr);
+			found_cards.push_back(ptr);
 		else
 			continue;
 	}
+	if(query.generation != search_generation)
+		return false;
+	SortCards(found_cards, query.text.c_str(), query.sort_type);
+	return true;
+}
+void DeckBuilder::UpdateIndex() {
+	if(card_index.IsBuilt())
+		return;
+	// stop the search reading the index before it changes
+	++search_generation;
+	std::lock_guard<std::mutex> lock(index_mutex);
+	card_index.Build();
+}
+void DeckBuilder::SubmitSearch(const SearchQuery& query) {
+	search_mutex.lock();
+	pending_query = query;
+	pending_query.generation = ++search_generation;
+	has_query = true;
+	if(!search_running) {
+		search_running = true;
+		std::thread(SearchThread).detach();
+	}
+	search_mutex.unlock();
+}
+int DeckBuilder::SearchThread() {
+	DeckBuilder& builder = mainGame->deckBuilder;
+	builder.search_mutex.lock();
+	while(builder.has_query) {
+		SearchQuery query = builder.pending_query;
+		builder.has_query = false;
+		builder.search_mutex.unlock();
+		std::vector<code_pointer> found;
+		bool done;
+		{
+			std::lock_guard<std::mutex> lock(builder.index_mutex);
+			done = builder.RunSearch(query, found);
+		}
+		builder.search_mutex.lock();
+		if(done && query.generation == builder.search_generation) {
+			builder.search_results.swap(found);
+			builder.results_ready = true;
+			builder.results_sort_type = query.sort_type;
+		}
+	}
+	builder.search_running = false;
+	builder.search_mutex.unlock();
+	return 0;
+}
+void DeckBuilder::UpdateResults() {
+	search_mutex.lock();
+	if(!results_ready) {
+		search_mutex.unlock();
+		return;
+	}
+	results.swap(search_results);
+	search_results.clear();
+	results_ready = false;
+	int sort_type = results_sort_type;
+	search_mutex.unlock();
 	myswprintf(result_string, L"%d", results.size());
 	if(results.size() > 7) {
 		mainGame->scrFilter->setVisible(true);
@@ -971,7 +1155,16 @@ void DeckBuilder::FilterCards() {
 		mainGame->scrFilter->setVisible(false);
 		mainGame->scrFilter->setPos(0);
 	}
-	SortList();
+	if(sort_type != mainGame->cbSortType->getSelected())
+		SortList();
+}
+void DeckBuilder::CancelSearch() {
+	search_mutex.lock();
+	++search_generation;
+	has_query = false;
+	results_ready = false;
+	search_results.clear();
+	search_mutex.unlock();
 }
 void DeckBuilder::InstantSearch() {
 	if(mainGame->gameConf.auto_search_limit >= 0 && (wcslen(mainGame->ebCardName->getText()) >= mainGame->gameConf.auto_search_limit))
@@ -991,6 +1184,7 @@ void DeckBuilder::ClearSearch() {
 	mainGame->scrFilter->setVisible(false);
 	mainGame->scrFilter->setPos(0);
 	ClearFilter();
+	CancelSearch();
 	results.clear();
 	myswprintf(result_string, L"%d", 0);
 }
@@ -1012,48 +1206,7 @@ void DeckBuilder::ClearFilter() {
 	mainGame->btnMarksFilter->setPressed(false);
 }
 void DeckBuilder::SortList() {
-	auto left = results.begin();
-	const wchar_t* pstr = mainGame->ebCardName->getText();
-	for(auto it = results.begin(); it != results.end(); ++it) {
-		if(wcscmp(pstr, dataManager.GetName((*it)->first)) == 0) {
-			std::iter_swap(left, it);
-			++left;
-		}
-	}
-	switch(mainGame->cbSortType->getSelected()) {
-	case 0:
-		std::sort(left, results.end(), ClientCard::deck_sort_lv);
-		break;
-	case 1:
-		std::sort(left, results.end(), ClientCard::deck_sort_atk);
-		break;
-	case 2:
-		std::sort(left, results.end(), ClientCard::deck_sort_def);
-		break;
-	case 3:
-		std::sort(left, results.end(), ClientCard::deck_sort_name);
-		break;
-	}
-}
-static inline wchar_t NormalizeChar(wchar_t c) {
-	/*
-	// Convert all symbols and punctuations to space.
-	if (c != 0 && c < 128 && !isalnum(c)) {
-		return ' ';
-	}
-	*/
-	// Convert latin chararacters to uppercase to ignore case.
-	if (c < 128 && isalpha(c)) {
-		return toupper(c);
-	}
-	// Remove some accentued characters that are not supported by the editbox.
-	if (c >= 232 && c <= 235) {
-		return 'E';
-	}
-	if (c >= 238 && c <= 239) {
-		return 'I';
-	}
-	return c;
+	SortCards(results, mainGame->ebCardName->getText(), mainGame->cbSortType->getSelected());
 }
 bool DeckBuilder::CardNameContains(const wchar_t *haystack, const wchar_t *needle)
 {
@@ -1066,8 +1219,8 @@ bool DeckBuilder::CardNameContains(const wchar_t *haystack, const wchar_t *needl
 	int i = 0;
 	int j = 0;
 	while (haystack[i]) {
-		wchar_t ca = NormalizeChar(haystack[i]);
-		wchar_t cb = NormalizeChar(needle[j]);
+		wchar_t ca = CardIndex::NormalizeChar(haystack[i]);
+		wchar_t cb = CardIndex::NormalizeChar(needle[j]);
 		if (ca == cb) {
 			j++;
 			if (!needle[j]) {
@@ -2,14 +2,53 @@
 #define DECK_CON_H
 
 #include "config.h"
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 #include "client_card.h"
+#include "card_index.h"
 
 namespace ygo {
 
+// a deck builder search, copied from the filter boxes when it is started
+struct SearchQuery {
+	struct element_t {
+		std::wstring keyword;
+		int setcode;
+		enum class type_t {
+			all,
+			name,
+			setcode
+		} type;
+		bool exclude;
+		element_t(): setcode(0), type(type_t::all), exclude(false) {}
+	};
+	std::wstring text;
+	std::vector<element_t> elements;
+	long long filter_effect;
+	unsigned int filter_type;
+	unsigned int filter_type2;
+	unsigned int filter_attrib;
+	unsigned int filter_race;
+	unsigned int filter_atktype;
+	int filter_atk;
+	unsigned int filter_deftype;
+	int filter_def;
+	unsigned int filter_lvtype;
+	unsigned int filter_lv;
+	unsigned int filter_scltype;
+	unsigned int filter_scl;
+	unsigned int filter_marks;
+	int filter_lm;
+	const std::unordered_map<int, int>* filterList;
+	int sort_type;
+	unsigned int generation;
+};
+
 class DeckBuilder: public irr::IEventReceiver {
 public:
+	DeckBuilder(): search_generation(0), has_query(false), search_running(false), results_ready(false), results_sort_type(0) {}
 	virtual bool OnEvent(const irr::SEvent& event);
 	void Initialize();
 	void Terminate();
@@ -20,6 +59,9 @@ public:
 	void InstantSearch();
 	void ClearSearch();
 	void SortList();
+	// takes the results of the last search once it is done, from the main thread
+	void UpdateResults();
+	void CancelSearch();
 
 	bool CardNameContains(const wchar_t *haystack, const wchar_t *needle);
 
@@ -68,6 +110,25 @@ public:
 	const std::unordered_map<int, int>* filterList;
 	std::vector<code_pointer> results;
 	wchar_t result_string[8];
+	CardIndex card_index;
+
+private:
+	void UpdateIndex();
+	void SubmitSearch(const SearchQuery& query);
+	// false if a newer search started before this one was done
+	bool RunSearch(const SearchQuery& query, std::vector<code_pointer>& found);
+	static int SearchThread();
+
+	std::mutex search_mutex;
+	// held by the search thread while it reads card_index
+	std::mutex index_mutex;
+	std::atomic<unsigned int> search_generation;
+	SearchQuery pending_query;
+	bool has_query;
+	bool search_running;
+	std::vector<code_pointer> search_results;
+	bool results_ready;
+	int results_sort_type;
 };
 
 }
@@ -2,7 +2,7 @@
 #define DECKMANAGER_H
 
 #include "config.h"
-#include "client_card.h"
+#include "card_data.h"
 #include <unordered_map>
 #include <vector>
 
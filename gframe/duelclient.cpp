@@ -118,6 +118,9 @@ void DuelClient::ClientEvent(bufferevent *bev, short events, void *ctx) {
 		CTOS_PlayerInfo cspi;
 		BufferIO::CopyWStr(mainGame->ebNickName->getText(), cspi.name, 20);
 		SendPacketToServer(CTOS_PLAYER_INFO, cspi);
+		CTOS_Features csf;
+		csf.flags = FEATURE_DELTA_UPDATE;
+		SendPacketToServer(CTOS_FEATURES, csf);
 		if(create_game) {
 			CTOS_CreateGame cscg;
 			if(bot_mode) {
@@ -702,7 +705,7 @@ void DuelClient::HandleSTOCPacketLan(char* data, unsigned int len) {
 		}
 		if(mainGame->actionParam || !is_host) {
 			prep += sizeof(ReplayHeader);
-			memcpy(new_replay.comp_data, prep, len - sizeof(ReplayHeader) - 1);
+			new_replay.comp_data.assign(prep, prep + len - sizeof(ReplayHeader) - 1);
 			new_replay.comp_size = len - sizeof(ReplayHeader) - 1;
 			if(mainGame->actionParam)
 				new_replay.SaveReplay(mainGame->ebRSName->getText());
@@ -1202,6 +1205,14 @@ int DuelClient::ClientAnalyze(char * msg, unsigned int len) {
 		mainGame->gMutex.unlock();
 		return true;
 	}
+	case MSG_UPDATE_DELTA: {
+		int player = mainGame->LocalPlayer(BufferIO::ReadInt8(pbuf));
+		int location = BufferIO::ReadInt8(pbuf);
+		mainGame->gMutex.lock();
+		mainGame->dField.UpdateFieldDelta(player, location, pbuf, len - 3);
+		mainGame->gMutex.unlock();
+		return true;
+	}
 	case MSG_UPDATE_CARD: {
 		int player = mainGame->LocalPlayer(BufferIO::ReadInt8(pbuf));
 		int loc = BufferIO::ReadInt8(pbuf);
@@ -0,0 +1,126 @@
+#include "engine_pool.h"
+
+namespace ygo {
+
+std::vector<EnginePool::Worker*> EnginePool::workers;
+thread_local int EnginePool::self = -1;
+std::atomic<unsigned int> EnginePool::next_worker(0);
+std::mutex EnginePool::idle_mutex;
+std::condition_variable EnginePool::idle_cond;
+int EnginePool::pending = 0;
+bool EnginePool::stopping = false;
+bool EnginePool::running = false;
+
+void EnginePool::Start(int thread_count) {
+	if(running || thread_count < 1)
+		return;
+	stopping = false;
+	pending = 0;
+	for(int i = 0; i < thread_count; ++i)
+		workers.push_back(new Worker);
+	for(int i = 0; i < thread_count; ++i)
+		workers[i]->thread = std::thread(WorkerThread, i);
+	running = true;
+}
+void EnginePool::Stop() {
+	if(!running)
+		return;
+	idle_mutex.lock();
+	stopping = true;
+	idle_mutex.unlock();
+	idle_cond.notify_all();
+	for(auto wit = workers.begin(); wit != workers.end(); ++wit) {
+		(*wit)->thread.join();
+		delete *wit;
+	}
+	workers.clear();
+	running = false;
+}
+void EnginePool::Post(EngineStrand* strand, std::function<void()> job) {
+	strand->depth.fetch_add(1, std::memory_order_relaxed);
+	strand->mutex.lock();
+	strand->jobs.push_back(std::move(job));
+	bool idle = !strand->scheduled;
+	strand->scheduled = true;
+	strand->mutex.unlock();
+	if(idle)
+		Schedule(strand);
+}
+void EnginePool::Wait(EngineStrand* strand) {
+	std::unique_lock<std::mutex> lock(strand->mutex);
+	strand->drained.wait(lock, [strand]() { return strand->depth.load(std::memory_order_relaxed) == 0; });
+}
+bool EnginePool::IsDrained(EngineStrand* strand) {
+	std::lock_guard<std::mutex> lock(strand->mutex);
+	return strand->depth.load(std::memory_order_relaxed) == 0;
+}
+void EnginePool::WorkerThread(int id) {
+	self = id;
+	while(true) {
+		EngineStrand* strand = Take(id);
+		if(strand) {
+			RunStrand(strand);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(idle_mutex);
+		idle_cond.wait(lock, []() { return stopping || pending > 0; });
+		if(stopping && pending <= 0)
+			break;
+	}
+	self = -1;
+}
+void EnginePool::Schedule(EngineStrand* strand) {
+	Worker* worker = workers[self >= 0 ? self : next_worker++ % workers.size()];
+	worker->mutex.lock();
+	worker->ready.push_back(strand);
+	worker->mutex.unlock();
+	idle_mutex.lock();
+	pending++;
+	idle_mutex.unlock();
+	idle_cond.notify_one();
+}
+EngineStrand* EnginePool::Take(int id) {
+	EngineStrand* strand = 0;
+	Worker* own = workers[id];
+	own->mutex.lock();
+	if(own->ready.size()) {
+		strand = own->ready.back();
+		own->ready.pop_back();
+	}
+	own->mutex.unlock();
+	for(size_t i = 1; !strand && i < workers.size(); ++i) {
+		Worker* victim = workers[(id + i) % workers.size()];
+		victim->mutex.lock();
+		if(victim->ready.size()) {
+			strand = victim->ready.front();
+			victim->ready.pop_front();
+		}
+		victim->mutex.unlock();
+	}
+	if(strand) {
+		idle_mutex.lock();
+		pending--;
+		idle_mutex.unlock();
+	}
+	return strand;
+}
+void EnginePool::RunStrand(EngineStrand* strand) {
+	strand->mutex.lock();
+	std::function<void()> job = std::move(strand->jobs.front());
+	strand->jobs.pop_front();
+	strand->mutex.unlock();
+	job();
+	strand->mutex.lock();
+	bool more = strand->jobs.size() != 0;
+	if(!more)
+		strand->scheduled = false;
+	// depth only drops to zero with no job left; the owner checks it under the
+	// mutex, so unlocking is the last touch before the strand may be freed
+	if(strand->depth.fetch_sub(1, std::memory_order_relaxed) == 1)
+		strand->drained.notify_all();
+	strand->mutex.unlock();
+	if(more)
+		Schedule(strand);
+}
+
+}
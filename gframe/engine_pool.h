@@ -0,0 +1,115 @@
+#ifndef ENGINE_POOL_H
+#define ENGINE_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <functional>
+
+namespace ygo {
+
+// Jobs posted to the same strand run one at a time, in posting order,
+// on whichever pool thread picks the strand up.
+class EngineStrand {
+public:
+	EngineStrand(): scheduled(false), depth(0) {}
+	int Depth() const {
+		return depth.load(std::memory_order_relaxed);
+	}
+
+private:
+	friend class EnginePool;
+	std::mutex mutex;
+	std::deque<std::function<void()>> jobs;
+	std::condition_variable drained;
+	bool scheduled;
+	std::atomic<int> depth;
+};
+
+// Multi-producer single-consumer queue (Vyukov). Push is lock-free and may be
+// called from any thread, Pop only from the owning thread.
+template<typename T>
+class MPSCQueue {
+public:
+	MPSCQueue() {
+		stub.next.store(0, std::memory_order_relaxed);
+		head.store(&stub, std::memory_order_relaxed);
+		tail = &stub;
+	}
+	~MPSCQueue() {
+		T value;
+		while(Pop(value));
+		if(tail != &stub)
+			delete tail;
+	}
+	void Push(const T& value) {
+		Node* node = new Node;
+		node->value = value;
+		node->next.store(0, std::memory_order_relaxed);
+		Node* prev = head.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+	}
+	bool Pop(T& value) {
+		Node* node = tail;
+		Node* next = node->next.load(std::memory_order_acquire);
+		if(!next)
+			return false;
+		value = next->value;
+		tail = next;
+		if(node != &stub)
+			delete node;
+		return true;
+	}
+
+private:
+	struct Node {
+		std::atomic<Node*> next;
+		T value;
+	};
+	std::atomic<Node*> head;
+	Node* tail;
+	Node stub;
+};
+
+// Work-stealing pool for ocgcore steps. Every thread owns a deque of runnable
+// strands; it pops its own deque from the back and steals from the front of
+// the others when it runs dry.
+class EnginePool {
+public:
+	static void Start(int thread_count);
+	static void Stop();
+	static bool IsRunning() {
+		return running;
+	}
+	static void Post(EngineStrand* strand, std::function<void()> job);
+	static void Wait(EngineStrand* strand);
+	// true once the pool holds no job of the strand and no longer touches it
+	static bool IsDrained(EngineStrand* strand);
+
+private:
+	struct Worker {
+		std::mutex mutex;
+		std::deque<EngineStrand*> ready;
+		std::thread thread;
+	};
+	static void WorkerThread(int id);
+	static void Schedule(EngineStrand* strand);
+	static EngineStrand* Take(int id);
+	static void RunStrand(EngineStrand* strand);
+
+	static std::vector<Worker*> workers;
+	static thread_local int self;
+	static std::atomic<unsigned int> next_worker;
+	static std::mutex idle_mutex;
+	static std::condition_variable idle_cond;
+	static int pending;
+	static bool stopping;
+	static bool running;
+};
+
+}
+
+#endif //ENGINE_POOL_H
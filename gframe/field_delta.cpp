@@ -0,0 +1,134 @@
+#include "field_delta.h"
+#include "field_mask.h"
+#include "msg_desc.h"
+#include "../ocgcore/common.h"
+#include <string.h>
+
+namespace ygo {
+
+// the client redraws these together, so a change to one resends the other
+static const unsigned int coupled_fields[][2] = {
+	{QUERY_LEVEL, QUERY_RANK},
+	{QUERY_TYPE, QUERY_DEFENSE},
+};
+
+static int ReadBlobInt(const char* p) {
+	int value;
+	memcpy(&value, p, sizeof(int));
+	return value;
+}
+static void WriteBlobInt(std::vector<char>& out, int value) {
+	const char* p = (const char*)&value;
+	out.insert(out.end(), p, p + sizeof(int));
+}
+
+bool FieldDelta::KeepsField(unsigned char msg) {
+	const MessageDesc* desc = MessageDesc::Get(msg);
+	return desc && (desc->flags & MSG_FLAG_KEEPS_FIELD);
+}
+void FieldDelta::Reset() {
+	slots.clear();
+	valid = false;
+}
+void FieldDelta::Seed(const char* data, int len) {
+	const char* end = data + len;
+	slots.clear();
+	valid = false;
+	while(end - data >= 4) {
+		int blen = ReadBlobInt(data);
+		if(blen < 4 || blen > end - data || slots.size() > 0xff)
+			break;
+		slots.push_back(Slot());
+		Slot& slot = slots.back();
+		slot.empty = blen == 4;
+		slot.known = 0;
+		if(blen >= 8) {
+			unsigned int flag = ReadBlobInt(data + 4);
+			const char* field[32];
+			int size[32];
+			if(flag && FieldMask::SplitFields(data + 8, blen - 8, flag, field, size)) {
+				for(int i = 0; i < 32; ++i)
+					if(field[i])
+						slot.fields[i].assign(field[i], size[i]);
+				slot.known = flag;
+			}
+		}
+		data += blen;
+	}
+	if(data != end) {
+		slots.clear();
+		return;
+	}
+	valid = true;
+}
+bool FieldDelta::Update(const char* data, int len, std::vector<char>& out) {
+	std::vector<const char*> blobs;
+	const char* pdata = data;
+	const char* end = data + len;
+	while(end - pdata >= 4) {
+		int blen = ReadBlobInt(pdata);
+		if(blen < 4 || blen > end - pdata)
+			break;
+		blobs.push_back(pdata);
+		pdata += blen;
+	}
+	// a card entered or left the location: the client has to rebuild it anyway
+	bool same_shape = valid && pdata == end && blobs.size() == slots.size();
+	for(size_t i = 0; same_shape && i < blobs.size(); ++i)
+		same_shape = slots[i].empty == (ReadBlobInt(blobs[i]) == 4);
+	if(!same_shape) {
+		Seed(data, len);
+		return false;
+	}
+	for(size_t i = 0; i < blobs.size(); ++i) {
+		const char* blob = blobs[i];
+		int blen = ReadBlobInt(blob);
+		if(blen <= 8)
+			continue;
+		unsigned int flag = ReadBlobInt(blob + 4);
+		// masked card, the client keeps what it had
+		if(!flag)
+			continue;
+		Slot& slot = slots[i];
+		const char* field[32];
+		int size[32];
+		if(!FieldMask::SplitFields(blob + 8, blen - 8, flag, field, size)) {
+			slot.known = 0;
+			out.push_back((char)i);
+			out.insert(out.end(), blob, blob + blen);
+			continue;
+		}
+		unsigned int changed = 0;
+		for(int b = 0; b < 32; ++b) {
+			if(!field[b])
+				continue;
+			if(!(slot.known & (1U << b)) || slot.fields[b].compare(0, std::string::npos, field[b], size[b]))
+				changed |= 1U << b;
+		}
+		for(size_t c = 0; c < sizeof(coupled_fields) / sizeof(coupled_fields[0]); ++c) {
+			if(changed & coupled_fields[c][0])
+				changed |= flag & coupled_fields[c][1];
+			if(changed & coupled_fields[c][1])
+				changed |= flag & coupled_fields[c][0];
+		}
+		if(!changed)
+			continue;
+		int dlen = 8;
+		for(int b = 0; b < 32; ++b)
+			if(changed & (1U << b))
+				dlen += size[b];
+		out.push_back((char)i);
+		WriteBlobInt(out, dlen);
+		WriteBlobInt(out, changed);
+		for(int b = 0; b < 32; ++b) {
+			if(!(changed & (1U << b)))
+				continue;
+			out.insert(out.end(), field[b], field[b] + size[b]);
+			slot.fields[b].assign(field[b], size[b]);
+		}
+		slot.known |= flag;
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef FIELD_DELTA_H
+#define FIELD_DELTA_H
+
+#include <string>
+#include <vector>
+
+namespace ygo {
+
+// What one group of viewers last received for a MSG_UPDATE_DATA location,
+// used to strip the query fields that did not change since then.
+class FieldDelta {
+public:
+	FieldDelta(): valid(false) {}
+	void Reset();
+	// data/len is the card list of a MSG_UPDATE_DATA (after player and location).
+	// Appends the MSG_UPDATE_DELTA entries to out and returns true, or returns
+	// false when the full message has to be sent; the snapshot follows the data
+	// either way.
+	bool Update(const char* data, int len, std::vector<char>& out);
+	// Whether the client leaves every card's query fields alone on this message.
+	// Anything else has to drop the snapshots.
+	static bool KeepsField(unsigned char msg);
+
+private:
+	struct Slot {
+		bool empty;
+		unsigned int known;
+		std::string fields[32];
+	};
+	void Seed(const char* data, int len);
+
+	std::vector<Slot> slots;
+	bool valid;
+};
+
+}
+
+#endif //FIELD_DELTA_H
@@ -0,0 +1,108 @@
+#include "field_mask.h"
+#include "../ocgcore/common.h"
+#include <string.h>
+
+namespace ygo {
+
+// in bit order
+static const QueryField query_fields[] = {
+	{QUERY_CODE, 4},
+	{QUERY_POSITION, 4},
+	{QUERY_ALIAS, 4},
+	{QUERY_TYPE, 4},
+	{QUERY_LEVEL, 4},
+	{QUERY_RANK, 4},
+	{QUERY_ATTRIBUTE, 4},
+	{QUERY_RACE, 4},
+	{QUERY_ATTACK, 4},
+	{QUERY_DEFENSE, 4},
+	{QUERY_BASE_ATTACK, 4},
+	{QUERY_BASE_DEFENSE, 4},
+	{QUERY_REASON, 4},
+	{QUERY_REASON_CARD, 4},
+	{QUERY_EQUIP_CARD, 4},
+	{QUERY_TARGET_CARD, 0},
+	{QUERY_OVERLAY_CARD, 0},
+	{QUERY_COUNTERS, 0},
+	{QUERY_OWNER, 4},
+	{QUERY_STATUS, 4},
+	{QUERY_LSCALE, 4},
+	{QUERY_RSCALE, 4},
+	{QUERY_LINK, 8},
+};
+
+static int ReadQueryInt(const char* p) {
+	int value;
+	memcpy(&value, p, sizeof(int));
+	return value;
+}
+// face-down cards on the field and in the hand belong to their controller only
+static bool IsHidden(int location, const char* position) {
+	if(!(location & (LOCATION_ONFIELD | LOCATION_HAND)))
+		return false;
+	if(!position)
+		return true;
+	unsigned int pos = (ReadQueryInt(position) >> 24) & 0xff;
+	if(location == LOCATION_HAND)
+		return !(pos & POS_FACEUP);
+	return (pos & POS_FACEDOWN) != 0;
+}
+
+const QueryField* FieldMask::GetField(unsigned int flag) {
+	for(size_t i = 0; i < sizeof(query_fields) / sizeof(query_fields[0]); ++i)
+		if(query_fields[i].flag == flag)
+			return &query_fields[i];
+	return 0;
+}
+bool FieldMask::SplitFields(const char* data, int len, unsigned int flag, const char** field, int* size) {
+	const char* end = data + len;
+	for(int i = 0; i < 32; ++i) {
+		field[i] = 0;
+		size[i] = 0;
+		if(!(flag & (1U << i)))
+			continue;
+		const QueryField* qf = GetField(1U << i);
+		if(!qf)
+			return false;
+		int fsize = qf->size;
+		if(!fsize) {
+			if(end - data < 4)
+				return false;
+			int count = ReadQueryInt(data);
+			if(count < 0 || count > (end - data) / 4)
+				return false;
+			fsize = 4 + count * 4;
+		}
+		if(end - data < fsize)
+			return false;
+		field[i] = data;
+		size[i] = fsize;
+		data += fsize;
+	}
+	return data == end;
+}
+int FieldMask::BuildPublic(const char* msg, int len, char* out) {
+	int location = (unsigned char)msg[2];
+	memcpy(out, msg, len);
+	const char* pdata = msg + 3;
+	const char* end = msg + len;
+	char* pout = out + 3;
+	while(end - pdata >= 4) {
+		int blen = ReadQueryInt(pdata);
+		if(blen < 4 || blen > end - pdata)
+			break;
+		if(blen > 8) {
+			// position comes right after the code, whatever else the query holds
+			unsigned int flag = ReadQueryInt(pdata + 4);
+			int offset = (flag & QUERY_CODE) ? 12 : 8;
+			const char* position = (flag & QUERY_POSITION) && blen >= offset + 4 ? pdata + offset : 0;
+			// flag 0 and no fields, at the length the owner got
+			if(IsHidden(location, position))
+				memset(pout + 4, 0, blen - 4);
+		}
+		pdata += blen;
+		pout += blen;
+	}
+	return len;
+}
+}
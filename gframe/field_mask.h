@@ -0,0 +1,26 @@
+#ifndef FIELD_MASK_H
+#define FIELD_MASK_H
+
+namespace ygo {
+
+// Layout of one QUERY_* field of a card query.
+struct QueryField {
+	unsigned int flag;
+	unsigned char size;		// 0: int32 count followed by count int32 entries
+};
+
+class FieldMask {
+public:
+	static const QueryField* GetField(unsigned int flag);
+	// Splits the fields of a card query (after len and flag) by bit index.
+	// Fails on a flag that is not in the table.
+	static bool SplitFields(const char* data, int len, unsigned int flag, const char** field, int* size);
+	// Writes the copy of a MSG_UPDATE_DATA (header included) that everyone but the
+	// owner gets into out, in a single walk of the card list, and returns its length.
+	// Hidden cards keep their length with everything after it zeroed, as before.
+	static int BuildPublic(const char* msg, int len, char* out);
+};
+
+}
+
+#endif //FIELD_MASK_H
@@ -5,12 +5,12 @@
 #include "deck_manager.h"
 #include "sound_manager.h"
 #include "replay.h"
+#include "replay_catalog.h"
 #include "materials.h"
 #include "duelclient.h"
 #include "netserver.h"
 #include "single_mode.h"
-
-const unsigned short PRO_VERSION = 0x1351;
+#include "startup_profile.h"
 
 namespace ygo {
 
@@ -70,9 +70,12 @@ bool Game::Initialize() {
 		}
 		CONFIG_HOME += "/ygopro";
 		DATA_HOME += "/ygopro";
+		dataManager.cache_path = DATA_HOME + "/cache";
 	}
 #endif
+	ProfileScope phase("config");
 	LoadConfig();
+	phase.Next("device");
 	irr::SIrrlichtCreationParameters params = irr::SIrrlichtCreationParameters();
 	params.AntiAlias = gameConf.antialias;
 	if(gameConf.use_d3d)
@@ -85,6 +88,7 @@ bool Game::Initialize() {
 		ErrorLog("Failed to create Irrlicht Engine device!");
 		return false;
 	}
+	phase.End();
 	xScale = 1;
 	yScale = 1;
 	linePatternD3D = 0;
@@ -104,33 +108,44 @@ bool Game::Initialize() {
 	memset(&dInfo, 0, sizeof(DuelInfo));
 	memset(chatTiming, 0, sizeof(chatTiming));
 #ifndef YGOPRO_ENVIRONMENT_PATHS
+	phase.Next("lflist");
 	deckManager.LoadLFList();
+	phase.End();
 #endif
 	driver = device->getVideoDriver();
 	driver->setTextureCreationFlag(irr::video::ETCF_CREATE_MIP_MAPS, false);
 	driver->setTextureCreationFlag(irr::video::ETCF_OPTIMIZED_FOR_QUALITY, true);
 	imageManager.SetDevice(device);
+	phase.Next("textures");
 	if(!imageManager.Initial()) {
 		ErrorLog("Failed to load textures!");
 		return false;
 	}
+	phase.End();
 	dataManager.FileSystem = device->getFileSystem();
 #ifdef YGOPRO_ENVIRONMENT_PATHS
+	phase.Next("data dirs");
 	LoadDataDirs();
 	deckManager.LoadLFList();
+	phase.End();
 #else
+	phase.Next("card databases");
 	LoadExpansions();
-	if(!dataManager.LoadDB(L"cards.cdb")) {
+	if(!dataManager.QueueDB(L"cards.cdb")) {
 		ErrorLog("Failed to load card database (cards.cdb)!");
 		return false;
 	}
+	dataManager.LoadQueuedDBs();
+	phase.Next("strings");
 	if(!dataManager.LoadStrings("strings.conf")) {
 		ErrorLog("Failed to load strings!");
 		return false;
 	}
 	dataManager.LoadStrings("./expansions/strings.conf");
+	phase.End();
 #endif
 	env = device->getGUIEnvironment();
+	phase.Next("fonts");
 	numFont = irr::gui::CGUITTFont::createTTFont(env, gameConf.numfont, 16);
 	adFont = irr::gui::CGUITTFont::createTTFont(env, gameConf.numfont, 12);
 	lpcFont = irr::gui::CGUITTFont::createTTFont(env, gameConf.numfont, 48);
@@ -140,6 +155,7 @@ bool Game::Initialize() {
 		ErrorLog("Failed to load font(s)!");
 		return false;
 	}
+	phase.Next("gui");
 	smgr = device->getSceneManager();
 	device->setWindowCaption(L"YGOPro");
 	device->setResizable(true);
@@ -807,6 +823,7 @@ bool Game::Initialize() {
 	stCardListTip->setVisible(false);
 	device->setEventReceiver(&menuHandler);
 	LoadConfig();
+	phase.Next("sound");
 	if(!soundManager.Init()) {
 		chkEnableSound->setChecked(false);
 		chkEnableSound->setEnabled(false);
@@ -819,6 +836,7 @@ bool Game::Initialize() {
 		chkMusicMode->setEnabled(false);
 		chkMusicMode->setVisible(false);
 	}
+	phase.End();
 	env->getSkin()->setFont(guiFont);
 	env->setFocus(wMainMenu);
 	for (u32 i = 0; i < EGDC_COUNT; ++i) {
@@ -887,6 +905,7 @@ void Game::MainLoop() {
 		} else if(is_building) {
 			soundManager.PlayBGM(BGM_DECK);
 			DrawBackImage(imageManager.tBackGround_deck);
+			deckBuilder.UpdateResults();
 			DrawDeckBd();
 		} else {
 			soundManager.PlayBGM(BGM_MENU);
@@ -1013,7 +1032,7 @@ bool Game::LoadDataDirs() {
 					size_t len = strlen(name);
 					std::string full_path = prefix + "/" + name;
 					if (len > 4 && !strncmp(name + len - 4, ".cdb", 4)) {
-						dataManager.LoadDB(full_path.c_str());
+						dataManager.QueueDB(full_path.c_str());
 						found_cdb = true;
 					}
 					if (len == 12 && !strncmp(name, "strings.conf", 12)) {
@@ -1025,6 +1044,7 @@ bool Game::LoadDataDirs() {
 					}
 				});
 		});
+	dataManager.LoadQueuedDBs();
 	if(!found_cdb) {
 		ErrorLog("No card database found");
 		return false;
@@ -1040,7 +1060,7 @@ void Game::LoadExpansions() {
 		if(!isdir && wcsrchr(name, '.') && !mywcsncasecmp(wcsrchr(name, '.'), L".cdb", 4)) {
 			wchar_t fpath[1024];
 			myswprintf(fpath, L"./expansions/%ls", name);
-			dataManager.LoadDB(fpath);
+			dataManager.QueueDB(fpath);
 		}
 		if(!isdir && wcsrchr(name, '.') && (!mywcsncasecmp(wcsrchr(name, '.'), L".zip", 4) || !mywcsncasecmp(wcsrchr(name, '.'), L".ypk", 4))) {
 			wchar_t fpath[1024];
@@ -1065,7 +1085,7 @@ void Game::LoadExpansions() {
 			BufferIO::DecodeUTF8(uname, fname);
 #endif
 			if(wcsrchr(fname, '.') && !mywcsncasecmp(wcsrchr(fname, '.'), L".cdb", 4))
-				dataManager.LoadDB(fname);
+				dataManager.QueueDB(fname);
 			if(wcsrchr(fname, '.') && !mywcsncasecmp(wcsrchr(fname, '.'), L".conf", 5)) {
 #ifdef _WIN32
 				IReadFile* reader = DataManager::FileSystem->createAndOpenFile(fname);
@@ -1113,21 +1133,16 @@ void Game::RefreshReplay() {
 	lstReplayList->clear();
 #ifdef XDG_ENVIRONMENT
 	std::string replay_dir = DATA_HOME + "/replay";
-	FileSystem::TraversalDir(replay_dir.c_str(), [this](const char* name, bool isdir) {
-		if(!isdir && strchr(name, '.') && !strncmp(strchr(name, '.'), ".yrp", 4)) {
-			size_t len = strlen(name);
-			wchar_t replay[256];
-			BufferIO::DecodeUTF8(name, replay);
-			if (Replay::CheckReplay(replay))
-				lstReplayList->addItem(replay);
-		}
-	});
+	wchar_t wreplay_dir[1024];
+	BufferIO::DecodeUTF8(replay_dir.c_str(), wreplay_dir);
+	replayCatalog.Refresh(wreplay_dir);
 #else
-	FileSystem::TraversalDir(L"./replay", [this](const wchar_t* name, bool isdir) {
-		if(!isdir && wcsrchr(name, '.') && !mywcsncasecmp(wcsrchr(name, '.'), L".yrp", 4) && Replay::CheckReplay(name))
-			lstReplayList->addItem(name);
-	});
+	replayCatalog.Refresh(L"./replay");
 #endif
+	for(auto rit = replayCatalog.entries.begin(); rit != replayCatalog.entries.end(); ++rit) {
+		if(rit->valid)
+			lstReplayList->addItem(rit->name.c_str());
+	}
 }
 void Game::RefreshSingleplay() {
 	lstSinglePlayList->clear();
@@ -1,6 +1,7 @@
 #include "config.h"
 #include "game.h"
 #include "data_manager.h"
+#include "startup_profile.h"
 #include <event2/thread.h>
 #include <memory>
 #ifdef __APPLE__
@@ -56,9 +57,14 @@ int main(int argc, char* argv[]) {
 #else
 	evthread_use_pthreads();
 #endif //_WIN32
+	for(int i = 1; i < argc; ++i)
+		ygo::StartupProfile::ParseArg(argv[i]);
 	ygo::Game _game;
 	ygo::mainGame = &_game;
-	if(!ygo::mainGame->Initialize())
+	ygo::StartupProfile::Begin("startup");
+	bool initialized = ygo::mainGame->Initialize();
+	ygo::StartupProfile::Report();
+	if(!initialized)
 		return 0;
 
 #ifdef _WIN32
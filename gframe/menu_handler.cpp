@@ -4,6 +4,7 @@
 #include "duelclient.h"
 #include "deck_manager.h"
 #include "replay_mode.h"
+#include "replay_catalog.h"
 #include "single_mode.h"
 #include "image_manager.h"
 #include "sound_manager.h"
@@ -398,6 +399,7 @@ bool MenuHandler::OnEvent(const irr::SEvent& event) {
 						myswprintf(newname, L"%ls.yrp", mainGame->ebRSName->getText());
 					}
 					if(Replay::RenameReplay(mainGame->lstReplayList->getListItem(prev_sel), newname)) {
+						replayCatalog.Rename(mainGame->lstReplayList->getListItem(prev_sel), newname);
 						mainGame->lstReplayList->setItem(prev_sel, newname, -1);
 					} else {
 						mainGame->env->addMessageBox(L"", dataManager.GetSysString(1365));
@@ -435,25 +437,19 @@ bool MenuHandler::OnEvent(const irr::SEvent& event) {
 				int sel = mainGame->lstReplayList->getSelected();
 				if(sel == -1)
 					break;
-				if(!ReplayMode::cur_replay.OpenReplay(mainGame->lstReplayList->getListItem(sel)))
+				const ReplayInfo* info = replayCatalog.Find(mainGame->lstReplayList->getListItem(sel));
+				if(!info)
 					break;
 				wchar_t infobuf[256];
 				std::wstring repinfo;
-				time_t curtime = ReplayMode::cur_replay.pheader.seed;
+				time_t curtime = info->header.seed;
 				tm* st = localtime(&curtime);
 				wcsftime(infobuf, 256, L"%Y/%m/%d %H:%M:%S\n", st);
 				repinfo.append(infobuf);
-				wchar_t namebuf[4][20];
-				ReplayMode::cur_replay.ReadName(namebuf[0]);
-				ReplayMode::cur_replay.ReadName(namebuf[1]);
-				if(ReplayMode::cur_replay.pheader.flag & REPLAY_TAG) {
-					ReplayMode::cur_replay.ReadName(namebuf[2]);
-					ReplayMode::cur_replay.ReadName(namebuf[3]);
-				}
-				if(ReplayMode::cur_replay.pheader.flag & REPLAY_TAG)
-					myswprintf(infobuf, L"%ls\n%ls\n===VS===\n%ls\n%ls\n", namebuf[0], namebuf[1], namebuf[2], namebuf[3]);
+				if(info->header.flag & REPLAY_TAG)
+					myswprintf(infobuf, L"%ls\n%ls\n===VS===\n%ls\n%ls\n", info->players[0], info->players[1], info->players[2], info->players[3]);
 				else
-					myswprintf(infobuf, L"%ls\n===VS===\n%ls\n", namebuf[0], namebuf[1]);
+					myswprintf(infobuf, L"%ls\n===VS===\n%ls\n", info->players[0], info->players[1]);
 				repinfo.append(infobuf);
 				mainGame->ebRepStartTurn->setText(L"1");
 				mainGame->SetStaticText(mainGame->stReplayInfo, 180, mainGame->guiFont, repinfo.c_str());
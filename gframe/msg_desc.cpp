@@ -0,0 +1,230 @@
+#include "msg_desc.h"
+#include "network.h"
+#include "../ocgcore/common.h"
+
+namespace ygo {
+
+template<int N>
+static int Fixed(const char* body, int size) {
+	return size >= N ? N : -1;
+}
+// H bytes, a count byte, then count entries of E bytes
+template<int H, int E>
+static int Counted(const char* body, int size) {
+	if(size < H + 1)
+		return -1;
+	int len = H + 1 + (unsigned char)body[H] * E;
+	return size >= len ? len : -1;
+}
+static int Rest(const char* body, int size) {
+	return size;
+}
+
+// walks bodies made of several count-prefixed groups
+class BodyReader {
+public:
+	BodyReader(const char* body, int size): body((const unsigned char*)body), size(size), pos(0) {}
+	void Skip(int bytes) {
+		pos += bytes;
+	}
+	int Count(int at) {
+		return at < size ? body[at] : 0;
+	}
+	void Group(int elem) {
+		if(pos >= size) {
+			pos = size + 1;
+			return;
+		}
+		pos += 1 + body[pos] * elem;
+	}
+	int Result() const {
+		return pos <= size ? pos : -1;
+	}
+
+private:
+	const unsigned char* body;
+	int size;
+	int pos;
+};
+
+static int SelectBattleCmd(const char* body, int size) {
+	BodyReader br(body, size);
+	br.Skip(1);
+	br.Group(11);
+	br.Group(8);
+	br.Skip(2);
+	return br.Result();
+}
+static int SelectIdleCmd(const char* body, int size) {
+	BodyReader br(body, size);
+	br.Skip(1);
+	for(int i = 0; i < 5; ++i)
+		br.Group(7);
+	br.Group(11);
+	br.Skip(3);
+	return br.Result();
+}
+static int SelectUnselectCard(const char* body, int size) {
+	BodyReader br(body, size);
+	br.Skip(5);
+	br.Group(8);
+	br.Group(8);
+	return br.Result();
+}
+static int SelectChain(const char* body, int size) {
+	BodyReader br(body, size);
+	br.Skip(12 + br.Count(1) * 13);
+	return size >= 2 ? br.Result() : -1;
+}
+static int SelectSum(const char* body, int size) {
+	BodyReader br(body, size);
+	br.Skip(8);
+	br.Group(11);
+	br.Group(11);
+	return br.Result();
+}
+static int TagSwap(const char* body, int size) {
+	BodyReader br(body, size);
+	br.Skip(9 + br.Count(4) * 4 + br.Count(2) * 4);
+	return size >= 5 ? br.Result() : -1;
+}
+static int ReloadField(const char* body, int size) {
+	BodyReader br(body, size);
+	br.Skip(1);
+	for(int p = 0; p < 2; ++p) {
+		br.Skip(4);
+		for(int seq = 0; seq < 7; ++seq) {
+			int at = br.Result();
+			br.Skip(at >= 0 && br.Count(at) ? 3 : 1);
+		}
+		for(int seq = 0; seq < 8; ++seq) {
+			int at = br.Result();
+			br.Skip(at >= 0 && br.Count(at) ? 2 : 1);
+		}
+		br.Skip(6);
+	}
+	br.Skip(1);
+	return br.Result();
+}
+// int16 length, then the UTF-8 text and its terminator
+static int Text(const char* body, int size) {
+	if(size < 2)
+		return -1;
+	int len = 2 + ((unsigned char)body[0] | ((unsigned char)body[1] << 8)) + 1;
+	return size >= len ? len : -1;
+}
+
+static const MessageDesc message_descs[] = {
+	{MSG_RETRY, "MSG_RETRY", Fixed<0>, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_HINT, "MSG_HINT", Fixed<6>, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_WAITING, "MSG_WAITING", Fixed<0>, MSG_ROUTE_NONE, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_START, "MSG_START", Fixed<18>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_WIN, "MSG_WIN", Fixed<2>, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_UPDATE_DATA, "MSG_UPDATE_DATA", Rest, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_UPDATE_CARD, "MSG_UPDATE_CARD", Rest, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_SELECT_BATTLECMD, "MSG_SELECT_BATTLECMD", SelectBattleCmd, MSG_ROUTE_PLAYER, MSG_REFRESH_ALL, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_SELECT_IDLECMD, "MSG_SELECT_IDLECMD", SelectIdleCmd, MSG_ROUTE_PLAYER, MSG_REFRESH_ALL, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_SELECT_EFFECTYN, "MSG_SELECT_EFFECTYN", Fixed<13>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE},
+	{MSG_SELECT_YESNO, "MSG_SELECT_YESNO", Fixed<5>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_SELECT_OPTION, "MSG_SELECT_OPTION", Counted<1, 4>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_SELECT_CARD, "MSG_SELECT_CARD", Counted<4, 8>, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_RESPONSE},
+	{MSG_SELECT_CHAIN, "MSG_SELECT_CHAIN", SelectChain, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE},
+	{MSG_SELECT_PLACE, "MSG_SELECT_PLACE", Fixed<6>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_SELECT_POSITION, "MSG_SELECT_POSITION", Fixed<6>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_SELECT_TRIBUTE, "MSG_SELECT_TRIBUTE", Counted<4, 8>, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_RESPONSE},
+	{MSG_SELECT_COUNTER, "MSG_SELECT_COUNTER", Counted<5, 9>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_SELECT_SUM, "MSG_SELECT_SUM", SelectSum, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_RESPONSE},
+	{MSG_SELECT_DISFIELD, "MSG_SELECT_DISFIELD", Fixed<6>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_SORT_CARD, "MSG_SORT_CARD", Counted<1, 7>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE},
+	{MSG_SELECT_UNSELECT_CARD, "MSG_SELECT_UNSELECT_CARD", SelectUnselectCard, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_RESPONSE},
+	{MSG_CONFIRM_DECKTOP, "MSG_CONFIRM_DECKTOP", Counted<1, 7>, MSG_ROUTE_ALL, 0, 0},
+	{MSG_CONFIRM_CARDS, "MSG_CONFIRM_CARDS", Counted<1, 7>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_SHUFFLE_DECK, "MSG_SHUFFLE_DECK", Fixed<1>, MSG_ROUTE_ALL, 0, 0},
+	{MSG_SHUFFLE_HAND, "MSG_SHUFFLE_HAND", Counted<1, 4>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_REFRESH_DECK, "MSG_REFRESH_DECK", Fixed<1>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_SWAP_GRAVE_DECK, "MSG_SWAP_GRAVE_DECK", Fixed<1>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_SHUFFLE_SET_CARD, "MSG_SHUFFLE_SET_CARD", Counted<1, 8>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_REVERSE_DECK, "MSG_REVERSE_DECK", Fixed<0>, MSG_ROUTE_ALL, 0, 0},
+	{MSG_DECK_TOP, "MSG_DECK_TOP", Fixed<6>, MSG_ROUTE_ALL, 0, 0},
+	{MSG_SHUFFLE_EXTRA, "MSG_SHUFFLE_EXTRA", Counted<1, 4>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_NEW_TURN, "MSG_NEW_TURN", Fixed<1>, MSG_ROUTE_CUSTOM, MSG_REFRESH_ALL, MSG_FLAG_KEEPS_FIELD},
+	{MSG_NEW_PHASE, "MSG_NEW_PHASE", Fixed<2>, MSG_ROUTE_ALL, MSG_REFRESH_ALL, MSG_FLAG_KEEPS_FIELD},
+	{MSG_CONFIRM_EXTRATOP, "MSG_CONFIRM_EXTRATOP", Counted<1, 7>, MSG_ROUTE_ALL, 0, 0},
+	{MSG_MOVE, "MSG_MOVE", Fixed<16>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_POS_CHANGE, "MSG_POS_CHANGE", Fixed<9>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_SET, "MSG_SET", Fixed<8>, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_NO_PAUSE},
+	{MSG_SWAP, "MSG_SWAP", Fixed<16>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_FIELD_DISABLED, "MSG_FIELD_DISABLED", Fixed<4>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD | MSG_FLAG_NO_PAUSE},
+	{MSG_SUMMONING, "MSG_SUMMONING", Fixed<8>, MSG_ROUTE_ALL, 0, MSG_FLAG_NO_PAUSE},
+	{MSG_SUMMONED, "MSG_SUMMONED", Fixed<0>, MSG_ROUTE_ALL, MSG_REFRESH_FIELD, MSG_FLAG_KEEPS_FIELD},
+	{MSG_SPSUMMONING, "MSG_SPSUMMONING", Fixed<8>, MSG_ROUTE_ALL, 0, MSG_FLAG_NO_PAUSE},
+	{MSG_SPSUMMONED, "MSG_SPSUMMONED", Fixed<0>, MSG_ROUTE_ALL, MSG_REFRESH_FIELD, MSG_FLAG_KEEPS_FIELD},
+	{MSG_FLIPSUMMONING, "MSG_FLIPSUMMONING", Fixed<8>, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_NO_PAUSE},
+	{MSG_FLIPSUMMONED, "MSG_FLIPSUMMONED", Fixed<0>, MSG_ROUTE_ALL, MSG_REFRESH_FIELD, MSG_FLAG_KEEPS_FIELD},
+	{MSG_CHAINING, "MSG_CHAINING", Fixed<16>, MSG_ROUTE_ALL, 0, 0},
+	{MSG_CHAINED, "MSG_CHAINED", Fixed<1>, MSG_ROUTE_ALL, MSG_REFRESH_ALL, MSG_FLAG_KEEPS_FIELD},
+	{MSG_CHAIN_SOLVING, "MSG_CHAIN_SOLVING", Fixed<1>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD | MSG_FLAG_NO_PAUSE},
+	{MSG_CHAIN_SOLVED, "MSG_CHAIN_SOLVED", Fixed<1>, MSG_ROUTE_ALL, MSG_REFRESH_ALL, MSG_FLAG_KEEPS_FIELD | MSG_FLAG_NO_PAUSE},
+	{MSG_CHAIN_END, "MSG_CHAIN_END", Fixed<0>, MSG_ROUTE_ALL, MSG_REFRESH_ALL, MSG_FLAG_KEEPS_FIELD | MSG_FLAG_NO_PAUSE},
+	{MSG_CHAIN_NEGATED, "MSG_CHAIN_NEGATED", Fixed<1>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_CHAIN_DISABLED, "MSG_CHAIN_DISABLED", Fixed<1>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_CARD_SELECTED, "MSG_CARD_SELECTED", Counted<1, 4>, MSG_ROUTE_NONE, 0, MSG_FLAG_KEEPS_FIELD | MSG_FLAG_NO_PAUSE},
+	{MSG_RANDOM_SELECTED, "MSG_RANDOM_SELECTED", Counted<1, 4>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD | MSG_FLAG_NO_PAUSE},
+	{MSG_BECOME_TARGET, "MSG_BECOME_TARGET", Counted<0, 4>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_DRAW, "MSG_DRAW", Counted<1, 4>, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_DAMAGE, "MSG_DAMAGE", Fixed<5>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_RECOVER, "MSG_RECOVER", Fixed<5>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_EQUIP, "MSG_EQUIP", Fixed<8>, MSG_ROUTE_ALL, 0, MSG_FLAG_NO_PAUSE},
+	{MSG_LPUPDATE, "MSG_LPUPDATE", Fixed<5>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_UNEQUIP, "MSG_UNEQUIP", Fixed<4>, MSG_ROUTE_ALL, 0, MSG_FLAG_NO_PAUSE},
+	{MSG_CARD_TARGET, "MSG_CARD_TARGET", Fixed<8>, MSG_ROUTE_ALL, 0, MSG_FLAG_NO_PAUSE},
+	{MSG_CANCEL_TARGET, "MSG_CANCEL_TARGET", Fixed<8>, MSG_ROUTE_ALL, 0, MSG_FLAG_NO_PAUSE},
+	{MSG_PAY_LPCOST, "MSG_PAY_LPCOST", Fixed<5>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_ADD_COUNTER, "MSG_ADD_COUNTER", Fixed<7>, MSG_ROUTE_ALL, 0, 0},
+	{MSG_REMOVE_COUNTER, "MSG_REMOVE_COUNTER", Fixed<7>, MSG_ROUTE_ALL, 0, 0},
+	{MSG_ATTACK, "MSG_ATTACK", Fixed<8>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_BATTLE, "MSG_BATTLE", Fixed<26>, MSG_ROUTE_ALL, 0, MSG_FLAG_NO_PAUSE},
+	{MSG_ATTACK_DISABLED, "MSG_ATTACK_DISABLED", Fixed<0>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD | MSG_FLAG_NO_PAUSE},
+	{MSG_DAMAGE_STEP_START, "MSG_DAMAGE_STEP_START", Fixed<0>, MSG_ROUTE_ALL, MSG_REFRESH_MZONE, MSG_FLAG_KEEPS_FIELD | MSG_FLAG_NO_PAUSE},
+	{MSG_DAMAGE_STEP_END, "MSG_DAMAGE_STEP_END", Fixed<0>, MSG_ROUTE_ALL, MSG_REFRESH_MZONE, MSG_FLAG_KEEPS_FIELD | MSG_FLAG_NO_PAUSE},
+	{MSG_MISSED_EFFECT, "MSG_MISSED_EFFECT", Fixed<8>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_TOSS_COIN, "MSG_TOSS_COIN", Counted<1, 1>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_TOSS_DICE, "MSG_TOSS_DICE", Counted<1, 1>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_ROCK_PAPER_SCISSORS, "MSG_ROCK_PAPER_SCISSORS", Fixed<1>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_HAND_RES, "MSG_HAND_RES", Fixed<1>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_ANNOUNCE_RACE, "MSG_ANNOUNCE_RACE", Fixed<6>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_ANNOUNCE_ATTRIB, "MSG_ANNOUNCE_ATTRIB", Fixed<6>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_ANNOUNCE_CARD, "MSG_ANNOUNCE_CARD", Counted<1, 4>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_ANNOUNCE_NUMBER, "MSG_ANNOUNCE_NUMBER", Counted<1, 4>, MSG_ROUTE_PLAYER, 0, MSG_FLAG_RESPONSE | MSG_FLAG_KEEPS_FIELD},
+	{MSG_CARD_HINT, "MSG_CARD_HINT", Fixed<9>, MSG_ROUTE_ALL, 0, 0},
+	{MSG_TAG_SWAP, "MSG_TAG_SWAP", TagSwap, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_RELOAD_FIELD, "MSG_RELOAD_FIELD", ReloadField, MSG_ROUTE_CUSTOM, 0, 0},
+	{MSG_AI_NAME, "MSG_AI_NAME", Text, MSG_ROUTE_NONE, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_SHOW_HINT, "MSG_SHOW_HINT", Text, MSG_ROUTE_NONE, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_PLAYER_HINT, "MSG_PLAYER_HINT", Fixed<6>, MSG_ROUTE_ALL, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_MATCH_KILL, "MSG_MATCH_KILL", Fixed<4>, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_KEEPS_FIELD},
+	{MSG_UPDATE_DELTA, "MSG_UPDATE_DELTA", Rest, MSG_ROUTE_CUSTOM, 0, MSG_FLAG_KEEPS_FIELD},
+};
+
+static const MessageDesc** BuildIndex() {
+	static const MessageDesc* index[256];
+	for(size_t i = 0; i < sizeof(message_descs) / sizeof(message_descs[0]); ++i)
+		index[message_descs[i].msg] = &message_descs[i];
+	return index;
+}
+
+const MessageDesc* MessageDesc::Get(unsigned char msg) {
+	static const MessageDesc** index = BuildIndex();
+	return index[msg];
+}
+int MessageDesc::Length(const char* msg, int size) {
+	if(size < 1)
+		return -1;
+	const MessageDesc* desc = Get(msg[0]);
+	if(!desc)
+		return -1;
+	int len = desc->length(msg + 1, size - 1);
+	return len < 0 ? -1 : len + 1;
+}
+
+}
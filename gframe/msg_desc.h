@@ -0,0 +1,40 @@
+#ifndef MSG_DESC_H
+#define MSG_DESC_H
+
+namespace ygo {
+
+// who receives an engine message that needs no per-recipient editing
+#define MSG_ROUTE_NONE		0	// consumed by the host
+#define MSG_ROUTE_ALL		1	// every duelist and observer
+#define MSG_ROUTE_PLAYER	2	// the player in the first byte of the body
+#define MSG_ROUTE_CUSTOM	3	// masked or split by the analyzer itself
+
+// locations of both players refreshed after the message
+#define MSG_REFRESH_MZONE	0x1
+#define MSG_REFRESH_SZONE	0x2
+#define MSG_REFRESH_HAND	0x4
+#define MSG_REFRESH_FIELD	(MSG_REFRESH_MZONE | MSG_REFRESH_SZONE)
+#define MSG_REFRESH_ALL		(MSG_REFRESH_FIELD | MSG_REFRESH_HAND)
+
+#define MSG_FLAG_RESPONSE		0x1	// the routed player has to answer
+#define MSG_FLAG_KEEPS_FIELD	0x2	// leaves the query fields of every client card alone
+#define MSG_FLAG_NO_PAUSE		0x4	// replay stepping does not stop after it
+
+struct MessageDesc {
+	unsigned char msg;
+	const char* name;
+	// size of the body after the type byte, -1 if it does not fit in size
+	int (*length)(const char* body, int size);
+	unsigned char route;
+	unsigned char refresh;
+	unsigned char flags;
+
+	static const MessageDesc* Get(unsigned char msg);
+	// Size of the message at msg including its type byte, or -1 for an unknown
+	// or truncated message.
+	static int Length(const char* msg, int size);
+};
+
+}
+
+#endif //MSG_DESC_H
@@ -44,6 +44,21 @@ public:
 		return CreateDirectoryW(wdir, NULL);
 	}
 
+	static bool GetFileInfo(const wchar_t* wfile, unsigned long long& size, long long& mtime) {
+		WIN32_FILE_ATTRIBUTE_DATA fdata;
+		if(!GetFileAttributesExW(wfile, GetFileExInfoStandard, &fdata) || (fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			return false;
+		size = ((unsigned long long)fdata.nFileSizeHigh << 32) | fdata.nFileSizeLow;
+		mtime = ((long long)fdata.ftLastWriteTime.dwHighDateTime << 32) | fdata.ftLastWriteTime.dwLowDateTime;
+		return true;
+	}
+
+	static bool GetFileInfo(const char* file, unsigned long long& size, long long& mtime) {
+		wchar_t wfile[1024];
+		BufferIO::DecodeUTF8(file, wfile);
+		return GetFileInfo(wfile, size, mtime);
+	}
+
 	static bool MakeDir(const char* dir) {
 		wchar_t wdir[1024];
 		BufferIO::DecodeUTF8(dir, wdir);
@@ -111,6 +126,21 @@ public:
 		return MakeDir(dir);
 	}
 
+	static bool GetFileInfo(const char* file, unsigned long long& size, long long& mtime) {
+		struct stat fileStat;
+		if(stat(file, &fileStat) != 0 || S_ISDIR(fileStat.st_mode))
+			return false;
+		size = fileStat.st_size;
+		mtime = fileStat.st_mtime;
+		return true;
+	}
+
+	static bool GetFileInfo(const wchar_t* wfile, unsigned long long& size, long long& mtime) {
+		char file[1024];
+		BufferIO::EncodeUTF8(wfile, file);
+		return GetFileInfo(file, size, mtime);
+	}
+
 	struct file_unit {
 		std::string filename;
 		bool is_dir;
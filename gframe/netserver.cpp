@@ -2,46 +2,81 @@
 #include "single_duel.h"
 #include "tag_duel.h"
 
+const unsigned short PRO_VERSION = 0x1351;
+// frames up to this size are copied into the socket's staging chain on flush,
+// larger ones (field refreshes, replays) stay shared references
+const size_t FRAME_COPY_LIMIT = 256;
+
 namespace ygo {
-std::unordered_map<bufferevent*, DuelPlayer> NetServer::users;
+std::vector<NetWorker*> NetServer::workers;
+thread_local NetWorker* NetServer::cur_worker = 0;
+std::mutex NetServer::server_mutex;
+std::mutex NetServer::rooms_mutex;
+unsigned int NetServer::next_worker = 0;
 unsigned short NetServer::server_port = 0;
-event_base* NetServer::net_evbase = 0;
 event* NetServer::broadcast_ev = 0;
 evconnlistener* NetServer::listener = 0;
-DuelMode* NetServer::duel_mode = 0;
-char NetServer::net_server_read[0x2000];
-char NetServer::net_server_write[0x2000];
-unsigned short NetServer::last_sent = 0;
+std::map<unsigned int, DuelMode*> NetServer::rooms;
+unsigned int NetServer::next_gameid = 1;
+bool NetServer::dedicated = false;
+thread_local char NetServer::net_server_read[0x2000];
+thread_local NetFrame* NetServer::last_frame = 0;
+thread_local std::vector<std::pair<DuelPlayer*, NetFrame*>>* NetServer::outbox = 0;
+std::mutex DuelMode::engine_mutex;
 
-bool NetServer::StartServer(unsigned short port) {
-	if(net_evbase)
+bool NetServer::StartServer(unsigned short port, bool is_dedicated, int worker_count) {
+	std::lock_guard<std::mutex> lock(server_mutex);
+	if(workers.size())
 		return false;
-	net_evbase = event_base_new();
-	if(!net_evbase)
+	if(worker_count < 1)
+		worker_count = 1;
+	for(int i = 0; i < worker_count; ++i) {
+		NetWorker* worker = new NetWorker;
+		worker->base = event_base_new();
+		worker->stopped = false;
+		if(!worker->base) {
+			delete worker;
+			break;
+		}
+		worker->complete_ev = event_new(worker->base, -1, 0, EngineComplete, worker);
+		workers.push_back(worker);
+	}
+	if(workers.size() == 0)
 		return false;
+	dedicated = is_dedicated;
+	next_gameid = 1;
+	next_worker = 0;
 	sockaddr_in sin;
 	memset(&sin, 0, sizeof(sin));
 	server_port = port;
 	sin.sin_family = AF_INET;
 	sin.sin_addr.s_addr = htonl(INADDR_ANY);
 	sin.sin_port = htons(port);
-	listener = evconnlistener_new_bind(net_evbase, ServerAccept, NULL,
+	listener = evconnlistener_new_bind(workers[0]->base, ServerAccept, NULL,
 	                                   LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1, (sockaddr*)&sin, sizeof(sin));
 	if(!listener) {
-		event_base_free(net_evbase);
-		net_evbase = 0;
+		for(auto wit = workers.begin(); wit != workers.end(); ++wit) {
+			event_free((*wit)->complete_ev);
+			event_base_free((*wit)->base);
+			delete *wit;
+		}
+		workers.clear();
 		return false;
 	}
 	evconnlistener_set_error_cb(listener, ServerAcceptError);
-	std::thread(ServerThread).detach();
+	for(auto wit = workers.begin(); wit != workers.end(); ++wit)
+		std::thread(ServerThread, *wit).detach();
 	return true;
 }
 bool NetServer::StartBroadcast() {
-	if(!net_evbase)
+	std::lock_guard<std::mutex> lock(server_mutex);
+	if(workers.empty() || workers[0]->stopped)
 		return false;
+	if(broadcast_ev)
+		return true;
 	SOCKET udp = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	BOOL opt = TRUE;
-	setsockopt(udp, SOL_SOCKET, SO_BROADCAST, (const char*)&opt, sizeof(BOOL));
+	int opt = 1;
+	setsockopt(udp, SOL_SOCKET, SO_BROADCAST, (const char*)&opt, sizeof(opt));
 	sockaddr_in addr;
 	memset(&addr, 0, sizeof(addr));
 	addr.sin_family = AF_INET;
@@ -51,19 +86,20 @@ bool NetServer::StartBroadcast() {
 		closesocket(udp);
 		return false;
 	}
-	broadcast_ev = event_new(net_evbase, udp, EV_READ | EV_PERSIST, BroadcastEvent, NULL);
+	broadcast_ev = event_new(workers[0]->base, udp, EV_READ | EV_PERSIST, BroadcastEvent, NULL);
 	event_add(broadcast_ev, NULL);
 	return true;
 }
 void NetServer::StopServer() {
-	if(!net_evbase)
-		return;
-	if(duel_mode)
-		duel_mode->EndDuel();
-	event_base_loopexit(net_evbase, 0);
+	std::lock_guard<std::mutex> lock(server_mutex);
+	timeval tv = {0, 0};
+	for(auto wit = workers.begin(); wit != workers.end(); ++wit)
+		if(!(*wit)->stopped)
+			event_base_once((*wit)->base, -1, EV_TIMEOUT, StopWorker, *wit, &tv);
 }
 void NetServer::StopBroadcast() {
-	if(!net_evbase || !broadcast_ev)
+	std::lock_guard<std::mutex> lock(server_mutex);
+	if(!broadcast_ev)
 		return;
 	event_del(broadcast_ev);
 	evutil_socket_t fd;
@@ -73,9 +109,15 @@ void NetServer::StopBroadcast() {
 	broadcast_ev = 0;
 }
 void NetServer::StopListen() {
+	if(dedicated)
+		return;
 	evconnlistener_disable(listener);
 	StopBroadcast();
 }
+bool NetServer::IsRunning() {
+	std::lock_guard<std::mutex> lock(server_mutex);
+	return workers.size() != 0;
+}
 void NetServer::BroadcastEvent(evutil_socket_t fd, short events, void* arg) {
 	sockaddr_in bc_addr;
 	socklen_t sz = sizeof(sockaddr_in);
@@ -89,33 +131,47 @@ void NetServer::BroadcastEvent(evutil_socket_t fd, short events, void* arg) {
 		sockTo.sin_addr.s_addr = bc_addr.sin_addr.s_addr;
 		sockTo.sin_family = AF_INET;
 		sockTo.sin_port = htons(7921);
-		HostPacket hp;
-		hp.identifier = NETWORK_SERVER_ID;
-		hp.port = server_port;
-		hp.version = PRO_VERSION;
-		hp.host = duel_mode->host_info;
-		BufferIO::CopyWStr(duel_mode->name, hp.name, 20);
-		sendto(fd, (const char*)&hp, sizeof(HostPacket), 0, (sockaddr*)&sockTo, sizeof(sockTo));
+		std::lock_guard<std::mutex> lock(rooms_mutex);
+		for(auto rit = rooms.begin(); rit != rooms.end(); ++rit) {
+			DuelMode* dm = rit->second;
+			if(dm->duel_stage != DUEL_STAGE_BEGIN)
+				continue;
+			HostPacket hp;
+			hp.identifier = NETWORK_SERVER_ID;
+			hp.port = server_port;
+			hp.version = PRO_VERSION;
+			hp.host = dm->host_info;
+			BufferIO::CopyWStr(dm->name, hp.name, 20);
+			sendto(fd, (const char*)&hp, sizeof(HostPacket), 0, (sockaddr*)&sockTo, sizeof(sockTo));
+		}
 	}
 }
 void NetServer::ServerAccept(evconnlistener* listener, evutil_socket_t fd, sockaddr* address, int socklen, void* ctx) {
-	bufferevent* bev = bufferevent_socket_new(net_evbase, fd, BEV_OPT_CLOSE_ON_FREE);
-	DuelPlayer dp;
-	dp.name[0] = 0;
-	dp.type = 0xff;
-	dp.bev = bev;
-	users[bev] = dp;
-	bufferevent_setcb(bev, ServerEchoRead, NULL, ServerEchoEvent, NULL);
-	bufferevent_enable(bev, EV_READ);
+	NetWorker* target = workers[next_worker++ % workers.size()];
+	if(target == cur_worker) {
+		AddPlayer(fd);
+		return;
+	}
+	PlayerHandoff* ph = new PlayerHandoff;
+	ph->fd = fd;
+	ph->name[0] = 0;
+	ph->join = false;
+	if(!PostToWorker(target, AdoptPlayer, ph)) {
+		evutil_closesocket(fd);
+		delete ph;
+	}
 }
 void NetServer::ServerAcceptError(evconnlistener* listener, void* ctx) {
-	event_base_loopexit(net_evbase, 0);
+	StopServer();
 }
 void NetServer::ServerEchoRead(bufferevent *bev, void *ctx) {
 	evbuffer* input = bufferevent_get_input(bev);
-	size_t len = evbuffer_get_length(input);
 	unsigned short packet_len = 0;
 	while(true) {
+		auto bit = cur_worker->users.find(bev);
+		if(bit == cur_worker->users.end())
+			return;
+		size_t len = evbuffer_get_length(input);
 		if(len < 2)
 			return;
 		evbuffer_copyout(input, &packet_len, 2);
@@ -123,81 +179,484 @@ void NetServer::ServerEchoRead(bufferevent *bev, void *ctx) {
 			return;
 		evbuffer_remove(input, net_server_read, packet_len + 2);
 		if(packet_len)
-			HandleCTOSPacket(&users[bev], &net_server_read[2], packet_len);
-		len -= packet_len + 2;
+			HandleCTOSPacket(&bit->second, &net_server_read[2], packet_len);
 	}
 }
 void NetServer::ServerEchoEvent(bufferevent* bev, short events, void* ctx) {
 	if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
-		DuelPlayer* dp = &users[bev];
+		auto bit = cur_worker->users.find(bev);
+		if(bit == cur_worker->users.end())
+			return;
+		DuelPlayer* dp = &bit->second;
 		DuelMode* dm = dp->game;
-		if(dm)
+		if(dm && dm->busy)
+			DeferPacket(dm, dp, 0, 0);
+		else if(dm)
 			dm->LeaveGame(dp);
 		else DisconnectPlayer(dp);
 	}
 }
-int NetServer::ServerThread() {
-	event_base_dispatch(net_evbase);
-	for(auto bit = users.begin(); bit != users.end(); ++bit) {
+int NetServer::ServerThread(NetWorker* worker) {
+	cur_worker = worker;
+	event* keepalive = event_new(worker->base, -1, EV_PERSIST, [](evutil_socket_t, short, void*) {}, 0);
+	timeval tv = {3600, 0};
+	event_add(keepalive, &tv);
+	event_base_dispatch(worker->base);
+	event_free(keepalive);
+	std::vector<DuelMode*> owned;
+	rooms_mutex.lock();
+	for(auto rit = rooms.begin(); rit != rooms.end();) {
+		if(rit->second->worker == worker) {
+			owned.push_back(rit->second);
+			rit = rooms.erase(rit);
+		} else
+			++rit;
+	}
+	rooms_mutex.unlock();
+	for(auto rit = owned.begin(); rit != owned.end(); ++rit)
+		EnginePool::Wait(&(*rit)->strand);
+	for(auto rit = worker->closed_rooms.begin(); rit != worker->closed_rooms.end(); ++rit)
+		EnginePool::Wait(&(*rit)->strand);
+	DuelMode* done;
+	while(worker->completed.Pop(done)) {
+		for(auto oit = done->outbox.begin(); oit != done->outbox.end(); ++oit)
+			oit->second->Release();
+		done->outbox.clear();
+	}
+	event_free(worker->complete_ev);
+	worker->complete_ev = 0;
+	for(auto bit = worker->users.begin(); bit != worker->users.end(); ++bit) {
 		bufferevent_disable(bit->first, EV_READ);
 		bufferevent_free(bit->first);
 	}
-	users.clear();
-	evconnlistener_free(listener);
-	listener = 0;
-	if(broadcast_ev) {
-		evutil_socket_t fd;
-		event_get_assignment(broadcast_ev, 0, &fd, 0, 0, 0);
-		evutil_closesocket(fd);
-		event_free(broadcast_ev);
-		broadcast_ev = 0;
+	worker->users.clear();
+	for(auto rit = owned.begin(); rit != owned.end(); ++rit) {
+		event_free((*rit)->etimer);
+		delete *rit;
 	}
-	if(duel_mode) {
-		event_free(duel_mode->etimer);
-		delete duel_mode;
+	for(auto rit = worker->closed_rooms.begin(); rit != worker->closed_rooms.end(); ++rit)
+		delete *rit;
+	worker->closed_rooms.clear();
+	server_mutex.lock();
+	worker->stopped = true;
+	if(worker == workers[0]) {
+		evconnlistener_free(listener);
+		listener = 0;
+		if(broadcast_ev) {
+			evutil_socket_t fd;
+			event_get_assignment(broadcast_ev, 0, &fd, 0, 0, 0);
+			evutil_closesocket(fd);
+			event_free(broadcast_ev);
+			broadcast_ev = 0;
+		}
+	}
+	server_mutex.unlock();
+	event_base_free(worker->base);
+	worker->base = 0;
+	cur_worker = 0;
+	server_mutex.lock();
+	bool all_stopped = true;
+	for(auto wit = workers.begin(); wit != workers.end(); ++wit)
+		if((*wit)->base)
+			all_stopped = false;
+	if(all_stopped) {
+		for(auto wit = workers.begin(); wit != workers.end(); ++wit)
+			delete *wit;
+		workers.clear();
 	}
-	duel_mode = 0;
-	event_base_free(net_evbase);
-	net_evbase = 0;
+	server_mutex.unlock();
 	return 0;
 }
+void NetServer::StopWorker(evutil_socket_t fd, short events, void* arg) {
+	std::vector<DuelMode*> owned;
+	rooms_mutex.lock();
+	for(auto rit = rooms.begin(); rit != rooms.end(); ++rit)
+		if(rit->second->worker == cur_worker)
+			owned.push_back(rit->second);
+	rooms_mutex.unlock();
+	// let in-flight engine steps land before ending the duels
+	for(auto rit = owned.begin(); rit != owned.end(); ++rit) {
+		while((*rit)->busy) {
+			EnginePool::Wait(&(*rit)->strand);
+			EngineComplete(-1, 0, cur_worker);
+		}
+	}
+	owned.clear();
+	rooms_mutex.lock();
+	for(auto rit = rooms.begin(); rit != rooms.end(); ++rit)
+		if(rit->second->worker == cur_worker)
+			owned.push_back(rit->second);
+	rooms_mutex.unlock();
+	for(auto rit = owned.begin(); rit != owned.end(); ++rit)
+		(*rit)->EndDuel();
+	event_base_loopexit(cur_worker->base, 0);
+}
+bool NetServer::PostToWorker(NetWorker* worker, event_callback_fn cb, void* arg) {
+	std::lock_guard<std::mutex> lock(server_mutex);
+	if(worker->stopped)
+		return false;
+	timeval tv = {0, 0};
+	return event_base_once(worker->base, -1, EV_TIMEOUT, cb, arg, &tv) == 0;
+}
+DuelPlayer* NetServer::AddPlayer(evutil_socket_t fd) {
+	bufferevent* bev = bufferevent_socket_new(cur_worker->base, fd, BEV_OPT_CLOSE_ON_FREE);
+	DuelPlayer dp;
+	dp.name[0] = 0;
+	dp.type = 0xff;
+	dp.bev = bev;
+	DuelPlayer* pdp = &(cur_worker->users[bev] = dp);
+	bufferevent_setcb(bev, ServerEchoRead, NULL, ServerEchoEvent, NULL);
+	bufferevent_enable(bev, EV_READ);
+	return pdp;
+}
+void NetServer::HandoffPlayer(DuelPlayer* dp, NetWorker* target, CTOS_JoinGame* pkt) {
+	PlayerHandoff* ph = new PlayerHandoff;
+	bufferevent* bev = dp->bev;
+	ph->fd = bufferevent_getfd(bev);
+	memcpy(ph->name, dp->name, sizeof(ph->name));
+	ph->features = dp->features;
+	ph->join = true;
+	ph->join_info = *pkt;
+	evbuffer* input = bufferevent_get_input(bev);
+	ph->input.resize(evbuffer_get_length(input));
+	evbuffer_remove(input, ph->input.data(), ph->input.size());
+	evbuffer* output = bufferevent_get_output(bev);
+	ph->output.resize(evbuffer_get_length(output));
+	evbuffer_remove(output, ph->output.data(), ph->output.size());
+	bufferevent_disable(bev, EV_READ | EV_WRITE);
+	bufferevent_setfd(bev, -1);
+	bufferevent_free(bev);
+	cur_worker->users.erase(bev);
+	if(!PostToWorker(target, AdoptPlayer, ph)) {
+		evutil_closesocket(ph->fd);
+		delete ph;
+	}
+}
+void NetServer::AdoptPlayer(evutil_socket_t fd, short events, void* arg) {
+	PlayerHandoff* ph = (PlayerHandoff*)arg;
+	DuelPlayer* dp = AddPlayer(ph->fd);
+	bufferevent* bev = dp->bev;
+	memcpy(dp->name, ph->name, sizeof(dp->name));
+	dp->features = ph->features;
+	if(ph->output.size())
+		bufferevent_write(bev, ph->output.data(), ph->output.size());
+	if(ph->join)
+		JoinRoom(dp, &ph->join_info);
+	if(ph->input.size() && cur_worker->users.count(bev)) {
+		evbuffer_prepend(bufferevent_get_input(bev), ph->input.data(), ph->input.size());
+		ServerEchoRead(bev, 0);
+	}
+	delete ph;
+}
 void NetServer::DisconnectPlayer(DuelPlayer* dp) {
-	auto bit = users.find(dp->bev);
-	if(bit != users.end()) {
+	auto bit = cur_worker->users.find(dp->bev);
+	if(bit != cur_worker->users.end()) {
 		bufferevent_flush(dp->bev, EV_WRITE, BEV_FLUSH);
 		bufferevent_disable(dp->bev, EV_READ);
 		bufferevent_free(dp->bev);
-		users.erase(bit);
+		cur_worker->users.erase(bit);
+	}
+}
+DuelMode* NetServer::CreateRoom(CTOS_CreateGame* pkt) {
+	HostInfo& info = pkt->info;
+	std::lock_guard<std::mutex> lock(rooms_mutex);
+	if(!dedicated && rooms.size())
+		return 0;
+	if(info.rule > 3)
+		info.rule = 0;
+	if(info.mode > 2)
+		info.mode = 0;
+	unsigned int hash = 1;
+	for(auto lfit = deckManager._lfList.begin(); lfit != deckManager._lfList.end(); ++lfit) {
+		if(info.lflist == lfit->hash) {
+			hash = info.lflist;
+			break;
+		}
+	}
+	if(hash == 1)
+		info.lflist = deckManager._lfList[0].hash;
+	DuelMode* dm;
+	if(info.mode == MODE_TAG) {
+		dm = new TagDuel();
+		dm->etimer = event_new(cur_worker->base, 0, EV_TIMEOUT | EV_PERSIST, TagDuel::TagTimer, dm);
+	} else {
+		dm = new SingleDuel(info.mode == MODE_MATCH);
+		dm->etimer = event_new(cur_worker->base, 0, EV_TIMEOUT | EV_PERSIST, SingleDuel::SingleTimer, dm);
+	}
+	while(!next_gameid || rooms.count(next_gameid))
+		next_gameid++;
+	dm->gameid = next_gameid++;
+	dm->worker = cur_worker;
+	dm->host_info = info;
+	// set before the room is listed, joins on other workers match on them
+	BufferIO::CopyWStr(pkt->name, dm->name, 20);
+	BufferIO::CopyWStr(pkt->pass, dm->pass, 20);
+	rooms[dm->gameid] = dm;
+	return dm;
+}
+void NetServer::JoinRoom(DuelPlayer* dp, CTOS_JoinGame* pkt) {
+	if(dp->game) {
+		dp->game->JoinGame(dp, pkt, false);
+		return;
+	}
+	DuelMode* dm = 0;
+	rooms_mutex.lock();
+	if(pkt->gameid) {
+		auto rit = rooms.find(pkt->gameid);
+		if(rit != rooms.end())
+			dm = rit->second;
+	} else if(!dedicated) {
+		if(rooms.size())
+			dm = rooms.begin()->second;
+	} else {
+		// clients without a game id join the first room still waiting for
+		// players whose password matches theirs
+		wchar_t jpass[20];
+		BufferIO::CopyWStr(pkt->pass, jpass, 20);
+		for(auto rit = rooms.begin(); rit != rooms.end(); ++rit) {
+			if(rit->second->duel_stage == DUEL_STAGE_BEGIN && !wcscmp(rit->second->pass, jpass)) {
+				dm = rit->second;
+				break;
+			}
+		}
+	}
+	NetWorker* target = dm ? dm->worker : 0;
+	if(dm)
+		pkt->gameid = dm->gameid;
+	rooms_mutex.unlock();
+	if(!dm) {
+		STOC_ErrorMsg scem;
+		scem.msg = ERRMSG_JOINERROR;
+		scem.code = 0;
+		SendPacketToPlayer(dp, STOC_ERROR_MSG, scem);
+		return;
+	}
+	if(target != cur_worker) {
+		HandoffPlayer(dp, target, pkt);
+		return;
+	}
+	if(dm->busy) {
+		char buf[1 + sizeof(CTOS_JoinGame)];
+		buf[0] = CTOS_JOIN_GAME;
+		memcpy(&buf[1], pkt, sizeof(CTOS_JoinGame));
+		DeferPacket(dm, dp, buf, sizeof(buf));
+		return;
+	}
+	dm->JoinGame(dp, pkt, false);
+}
+void NetServer::CloseRoom(DuelMode* dm) {
+	if(!dedicated) {
+		StopServer();
+		return;
+	}
+	rooms_mutex.lock();
+	auto rit = rooms.find(dm->gameid);
+	bool found = rit != rooms.end() && rit->second == dm;
+	if(found)
+		rooms.erase(rit);
+	rooms_mutex.unlock();
+	if(!found)
+		return;
+	std::vector<DuelPlayer*> members;
+	for(auto bit = cur_worker->users.begin(); bit != cur_worker->users.end(); ++bit)
+		if(bit->second.game == dm)
+			members.push_back(&bit->second);
+	for(auto pit = members.begin(); pit != members.end(); ++pit)
+		DisconnectPlayer(*pit);
+	event_free(dm->etimer);
+	dm->etimer = 0;
+	cur_worker->closed_rooms.insert(dm);
+	timeval tv = {0, 0};
+	event_base_once(cur_worker->base, -1, EV_TIMEOUT, FreeRoom, dm, &tv);
+}
+void NetServer::FreeRoom(evutil_socket_t fd, short events, void* arg) {
+	DuelMode* dm = (DuelMode*)arg;
+	if(!cur_worker->closed_rooms.count(dm))
+		return;
+	// a pool thread may still be finishing the room's last step
+	if(dm->busy || !EnginePool::IsDrained(&dm->strand)) {
+		timeval tv = {0, 1000};
+		event_base_once(cur_worker->base, -1, EV_TIMEOUT, FreeRoom, dm, &tv);
+		return;
+	}
+	cur_worker->closed_rooms.erase(dm);
+	delete dm;
+}
+void NetServer::ProcessDuel(DuelMode* dm) {
+	if(!EnginePool::IsRunning()) {
+		outbox = &dm->outbox;
+		dm->Process();
+		outbox = 0;
+		FlushOutbox(dm);
+		return;
+	}
+	// the room takes no input until the step comes back through EngineComplete
+	dm->busy = true;
+	dm->queue_depth++;
+	NetWorker* worker = cur_worker;
+	EnginePool::Post(&dm->strand, [dm, worker]() {
+		outbox = &dm->outbox;
+		dm->Process();
+		outbox = 0;
+		worker->completed.Push(dm);
+		event_active(worker->complete_ev, EV_TIMEOUT, 0);
+	});
+}
+void NetServer::EngineComplete(evutil_socket_t fd, short events, void* arg) {
+	NetWorker* worker = (NetWorker*)arg;
+	DuelMode* dm;
+	while(worker->completed.Pop(dm)) {
+		FlushOutbox(dm);
+		dm->busy = false;
+		dm->queue_depth--;
+		RunDeferred(dm);
+	}
+}
+void NetServer::FlushOutbox(DuelMode* dm) {
+	// gather each connection's frames and hand them over in one append
+	std::vector<std::pair<DuelPlayer*, evbuffer*>> staged;
+	for(auto oit = dm->outbox.begin(); oit != dm->outbox.end(); ++oit) {
+		evbuffer* buf = 0;
+		for(auto sit = staged.begin(); sit != staged.end(); ++sit) {
+			if(sit->first == oit->first) {
+				buf = sit->second;
+				break;
+			}
+		}
+		if(!buf) {
+			buf = evbuffer_new();
+			staged.push_back(std::make_pair(oit->first, buf));
+		}
+		NetFrame* frame = oit->second;
+		if(frame->len <= FRAME_COPY_LIMIT) {
+			evbuffer_add(buf, frame->data(), frame->len);
+			frame->Release();
+		} else
+			evbuffer_add_reference(buf, frame->data(), frame->len, ReleaseFrame, frame);
+	}
+	dm->outbox.clear();
+	for(auto sit = staged.begin(); sit != staged.end(); ++sit) {
+		evbuffer_add_buffer(bufferevent_get_output(sit->first->bev), sit->second);
+		evbuffer_free(sit->second);
+	}
+}
+void NetServer::DeferPacket(DuelMode* dm, DuelPlayer* dp, const char* data, unsigned int len) {
+	DeferredPacket pkt;
+	pkt.bev = dp->bev;
+	if(len)
+		pkt.data.assign(data, data + len);
+	dm->deferred.push_back(std::move(pkt));
+	dm->queue_depth++;
+}
+void NetServer::RunDeferred(DuelMode* dm) {
+	while(!dm->busy && dm->deferred.size()) {
+		DeferredPacket pkt = std::move(dm->deferred.front());
+		dm->deferred.pop_front();
+		dm->queue_depth--;
+		auto bit = cur_worker->users.find(pkt.bev);
+		if(bit == cur_worker->users.end())
+			continue;
+		DuelPlayer* dp = &bit->second;
+		if(pkt.data.size())
+			HandleCTOSPacket(dp, pkt.data.data(), pkt.data.size());
+		else if(dp->game)
+			dp->game->LeaveGame(dp);
+		else DisconnectPlayer(dp);
+	}
+}
+void NetServer::SendUpdateData(FieldDelta& view, char* buffer, size_t len, DuelPlayer** targets, int count, std::set<DuelPlayer*>* observers) {
+	bool delta_viewer = false;
+	for(int i = 0; i < count; ++i)
+		if(targets[i] && (targets[i]->features & FEATURE_DELTA_UPDATE))
+			delta_viewer = true;
+	if(observers)
+		for(auto pit = observers->begin(); pit != observers->end(); ++pit)
+			if((*pit)->features & FEATURE_DELTA_UPDATE)
+				delta_viewer = true;
+	NetFrame* delta = 0;
+	bool unchanged = false;
+	if(!delta_viewer)
+		view.Reset();
+	else {
+		std::vector<char> entries(3);
+		if(view.Update(buffer + 3, len - 3, entries) && entries.size() < len) {
+			entries[0] = MSG_UPDATE_DELTA;
+			entries[1] = buffer[1];
+			entries[2] = buffer[2];
+			unchanged = entries.size() == 3;
+			if(!unchanged)
+				delta = NetFrame::Create(STOC_GAME_MSG, entries.data(), entries.size());
+		}
+	}
+	NewFrame(STOC_GAME_MSG, buffer, len);
+	for(int i = 0; i < count; ++i) {
+		DuelPlayer* dp = targets[i];
+		if(!dp)
+			continue;
+		if(!(dp->features & FEATURE_DELTA_UPDATE))
+			WriteFrame(dp, last_frame);
+		else if(!unchanged)
+			WriteFrame(dp, delta ? delta : last_frame);
+	}
+	if(observers) {
+		for(auto pit = observers->begin(); pit != observers->end(); ++pit) {
+			if(!((*pit)->features & FEATURE_DELTA_UPDATE))
+				WriteFrame(*pit, last_frame);
+			else if(!unchanged)
+				WriteFrame(*pit, delta ? delta : last_frame);
+		}
+	}
+	if(delta)
+		delta->Release();
+}
+void NetServer::GetRoomStats(std::vector<RoomStat>& stats) {
+	std::lock_guard<std::mutex> slock(server_mutex);
+	std::lock_guard<std::mutex> rlock(rooms_mutex);
+	for(auto rit = rooms.begin(); rit != rooms.end(); ++rit) {
+		DuelMode* dm = rit->second;
+		RoomStat rs;
+		rs.gameid = dm->gameid;
+		rs.worker = -1;
+		for(size_t i = 0; i < workers.size(); ++i)
+			if(workers[i] == dm->worker)
+				rs.worker = i;
+		rs.duel_stage = dm->duel_stage;
+		rs.queue_depth = dm->queue_depth;
+		stats.push_back(rs);
 	}
 }
 void NetServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len) {
+	if(dp->game && dp->game->busy) {
+		DeferPacket(dp->game, dp, data, len);
+		return;
+	}
 	char* pdata = data;
 	unsigned char pktType = BufferIO::ReadUInt8(pdata);
 	if((pktType != CTOS_SURRENDER) && (pktType != CTOS_CHAT) && (dp->state == 0xff || (dp->state && dp->state != pktType)))
 		return;
 	switch(pktType) {
 	case CTOS_RESPONSE: {
-		if(!dp->game || !duel_mode->pduel)
+		if(!dp->game || !dp->game->pduel)
 			return;
-		duel_mode->GetResponse(dp, pdata, len > 64 ? 64 : len - 1);
+		dp->game->GetResponse(dp, pdata, len > 64 ? 64 : len - 1);
 		break;
 	}
 	case CTOS_TIME_CONFIRM: {
-		if(!dp->game || !duel_mode->pduel)
+		if(!dp->game || !dp->game->pduel)
 			return;
-		duel_mode->TimeConfirm(dp);
+		dp->game->TimeConfirm(dp);
 		break;
 	}
 	case CTOS_CHAT: {
 		if(!dp->game)
 			return;
-		duel_mode->Chat(dp, pdata, len - 1);
+		dp->game->Chat(dp, pdata, len - 1);
 		break;
 	}
 	case CTOS_UPDATE_DECK: {
 		if(!dp->game)
 			return;
-		duel_mode->UpdateDeck(dp, pdata, len - 1);
+		dp->game->UpdateDeck(dp, pdata, len - 1);
 		break;
 	}
 	case CTOS_HAND_RESULT: {
@@ -219,88 +678,73 @@ void NetServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len) {
 		BufferIO::CopyWStr(pkt->name, dp->name, 20);
 		break;
 	}
+	case CTOS_FEATURES: {
+		CTOS_Features* pkt = (CTOS_Features*)pdata;
+		dp->features = pkt->flags & FEATURE_DELTA_UPDATE;
+		break;
+	}
 	case CTOS_CREATE_GAME: {
-		if(dp->game || duel_mode)
+		if(dp->game)
 			return;
 		CTOS_CreateGame* pkt = (CTOS_CreateGame*)pdata;
-		if(pkt->info.mode == MODE_SINGLE) {
-			duel_mode = new SingleDuel(false);
-			duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, SingleDuel::SingleTimer, duel_mode);
-		} else if(pkt->info.mode == MODE_MATCH) {
-			duel_mode = new SingleDuel(true);
-			duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, SingleDuel::SingleTimer, duel_mode);
-		} else if(pkt->info.mode == MODE_TAG) {
-			duel_mode = new TagDuel();
-			duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, TagDuel::TagTimer, duel_mode);
-		}
-		if(pkt->info.rule > 3)
-			pkt->info.rule = 0;
-		if(pkt->info.mode > 2)
-			pkt->info.mode = 0;
-		unsigned int hash = 1;
-		for(auto lfit = deckManager._lfList.begin(); lfit != deckManager._lfList.end(); ++lfit) {
-			if(pkt->info.lflist == lfit->hash) {
-				hash = pkt->info.lflist;
-				break;
-			}
-		}
-		if(hash == 1)
-			pkt->info.lflist = deckManager._lfList[0].hash;
-		duel_mode->host_info = pkt->info;
-		BufferIO::CopyWStr(pkt->name, duel_mode->name, 20);
-		BufferIO::CopyWStr(pkt->pass, duel_mode->pass, 20);
-		duel_mode->JoinGame(dp, 0, true);
+		DuelMode* dm = CreateRoom(pkt);
+		if(!dm)
+			return;
+		STOC_CreateGame sccg;
+		sccg.gameid = dm->gameid;
+		SendPacketToPlayer(dp, STOC_CREATE_GAME, sccg);
+		dm->JoinGame(dp, 0, true);
 		StartBroadcast();
 		break;
 	}
 	case CTOS_JOIN_GAME: {
-		if(!duel_mode)
-			break;
-		duel_mode->JoinGame(dp, pdata, false);
+		JoinRoom(dp, (CTOS_JoinGame*)pdata);
 		break;
 	}
 	case CTOS_LEAVE_GAME: {
-		if(!duel_mode)
+		if(!dp->game) {
+			DisconnectPlayer(dp);
 			break;
-		duel_mode->LeaveGame(dp);
+		}
+		dp->game->LeaveGame(dp);
 		break;
 	}
 	case CTOS_SURRENDER: {
-		if(!duel_mode)
+		if(!dp->game)
 			break;
-		duel_mode->Surrender(dp);
+		dp->game->Surrender(dp);
 		break;
 	}
 	case CTOS_HS_TODUELIST: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->ToDuelist(dp);
+		dp->game->ToDuelist(dp);
 		break;
 	}
 	case CTOS_HS_TOOBSERVER: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->ToObserver(dp);
+		dp->game->ToObserver(dp);
 		break;
 	}
 	case CTOS_HS_READY:
 	case CTOS_HS_NOTREADY: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->PlayerReady(dp, (CTOS_HS_NOTREADY - pktType) != 0);
+		dp->game->PlayerReady(dp, (CTOS_HS_NOTREADY - pktType) != 0);
 		break;
 	}
 	case CTOS_HS_KICK: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
 		CTOS_Kick* pkt = (CTOS_Kick*)pdata;
-		duel_mode->PlayerKick(dp, pkt->pos);
+		dp->game->PlayerKick(dp, pkt->pos);
 		break;
 	}
 	case CTOS_HS_START: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->StartDuel(dp);
+		dp->game->StartDuel(dp);
 		break;
 	}
 	}
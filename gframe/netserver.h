@@ -5,69 +5,125 @@
 #include "network.h"
 #include "data_manager.h"
 #include "deck_manager.h"
+#include "field_delta.h"
 #include <set>
+#include <map>
+#include <vector>
 #include <unordered_map>
 
 namespace ygo {
 
+struct NetWorker {
+	event_base* base;
+	std::unordered_map<bufferevent*, DuelPlayer> users;
+	std::set<DuelMode*> closed_rooms;
+	event* complete_ev;
+	MPSCQueue<DuelMode*> completed;
+	bool stopped;
+};
+
+struct RoomStat {
+	unsigned int gameid;
+	int worker;
+	int duel_stage;
+	int queue_depth;
+};
+
+struct PlayerHandoff {
+	evutil_socket_t fd;
+	unsigned short name[20];
+	unsigned int features;
+	bool join;
+	CTOS_JoinGame join_info;
+	std::vector<unsigned char> input;
+	std::vector<unsigned char> output;
+};
+
 class NetServer {
 private:
-	static std::unordered_map<bufferevent*, DuelPlayer> users;
+	static std::vector<NetWorker*> workers;
+	static thread_local NetWorker* cur_worker;
+	static std::mutex server_mutex;
+	static std::mutex rooms_mutex;
+	static unsigned int next_worker;
 	static unsigned short server_port;
-	static event_base* net_evbase;
 	static event* broadcast_ev;
 	static evconnlistener* listener;
-	static DuelMode* duel_mode;
-	static char net_server_read[0x2000];
-	static char net_server_write[0x2000];
-	static unsigned short last_sent;
+	static std::map<unsigned int, DuelMode*> rooms;
+	static unsigned int next_gameid;
+	static bool dedicated;
+	static thread_local char net_server_read[0x2000];
+	static thread_local NetFrame* last_frame;
+	static thread_local std::vector<std::pair<DuelPlayer*, NetFrame*>>* outbox;
 
 public:
-	static bool StartServer(unsigned short port);
+	static bool StartServer(unsigned short port, bool is_dedicated = false, int worker_count = 1);
 	static bool StartBroadcast();
 	static void StopServer();
 	static void StopBroadcast();
 	static void StopListen();
+	static bool IsRunning();
 	static void BroadcastEvent(evutil_socket_t fd, short events, void* arg);
 	static void ServerAccept(evconnlistener* listener, evutil_socket_t fd, sockaddr* address, int socklen, void* ctx);
 	static void ServerAcceptError(evconnlistener *listener, void* ctx);
 	static void ServerEchoRead(bufferevent* bev, void* ctx);
 	static void ServerEchoEvent(bufferevent* bev, short events, void* ctx);
-	static int ServerThread();
+	static int ServerThread(NetWorker* worker);
+	static void StopWorker(evutil_socket_t fd, short events, void* arg);
+	static bool PostToWorker(NetWorker* worker, event_callback_fn cb, void* arg);
+	static DuelPlayer* AddPlayer(evutil_socket_t fd);
+	static void HandoffPlayer(DuelPlayer* dp, NetWorker* target, CTOS_JoinGame* pkt);
+	static void AdoptPlayer(evutil_socket_t fd, short events, void* arg);
 	static void DisconnectPlayer(DuelPlayer* dp);
+	static DuelMode* CreateRoom(CTOS_CreateGame* pkt);
+	static void JoinRoom(DuelPlayer* dp, CTOS_JoinGame* pkt);
+	static void CloseRoom(DuelMode* dm);
+	static void FreeRoom(evutil_socket_t fd, short events, void* arg);
+	static void ProcessDuel(DuelMode* dm);
+	static void EngineComplete(evutil_socket_t fd, short events, void* arg);
+	static void FlushOutbox(DuelMode* dm);
+	static void DeferPacket(DuelMode* dm, DuelPlayer* dp, const char* data, unsigned int len);
+	static void RunDeferred(DuelMode* dm);
+	static void GetRoomStats(std::vector<RoomStat>& stats);
 	static void HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len);
-	static void SendPacketToPlayer(DuelPlayer* dp, unsigned char proto) {
-		char* p = net_server_write;
-		BufferIO::WriteInt16(p, 1);
-		BufferIO::WriteInt8(p, proto);
-		last_sent = 3;
-		if(!dp)
+	static void ReleaseFrame(const void* data, size_t len, void* arg) {
+		((NetFrame*)arg)->Release();
+	}
+	static void WriteFrame(DuelPlayer* dp, NetFrame* frame) {
+		frame->Retain();
+		if(outbox) {
+			// inside Process(): corked until FlushOutbox on the room's network thread
+			outbox->push_back(std::make_pair(dp, frame));
 			return;
-		bufferevent_write(dp->bev, net_server_write, last_sent);
+		}
+		evbuffer_add_reference(bufferevent_get_output(dp->bev), frame->data(), frame->len, ReleaseFrame, frame);
+	}
+	static void NewFrame(unsigned char proto, const void* payload, size_t len) {
+		if(last_frame)
+			last_frame->Release();
+		last_frame = NetFrame::Create(proto, payload, len);
+	}
+	static void SendPacketToPlayer(DuelPlayer* dp, unsigned char proto) {
+		NewFrame(proto, 0, 0);
+		if(dp)
+			WriteFrame(dp, last_frame);
 	}
 	template<typename ST>
 	static void SendPacketToPlayer(DuelPlayer* dp, unsigned char proto, ST& st) {
-		char* p = net_server_write;
-		BufferIO::WriteInt16(p, 1 + sizeof(ST));
-		BufferIO::WriteInt8(p, proto);
-		memcpy(p, &st, sizeof(ST));
-		last_sent = sizeof(ST) + 3;
+		NewFrame(proto, &st, sizeof(ST));
 		if(dp)
-			bufferevent_write(dp->bev, net_server_write, last_sent);
+			WriteFrame(dp, last_frame);
 	}
 	static void SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void* buffer, size_t len) {
-		char* p = net_server_write;
-		BufferIO::WriteInt16(p, 1 + len);
-		BufferIO::WriteInt8(p, proto);
-		memcpy(p, buffer, len);
-		last_sent = len + 3;
+		NewFrame(proto, buffer, len);
 		if(dp)
-			bufferevent_write(dp->bev, net_server_write, last_sent);
+			WriteFrame(dp, last_frame);
 	}
 	static void ReSendToPlayer(DuelPlayer* dp) {
-		if(dp)
-			bufferevent_write(dp->bev, net_server_write, last_sent);
+		if(dp && last_frame)
+			WriteFrame(dp, last_frame);
 	}
+	static void SendUpdateData(FieldDelta& view, char* buffer, size_t len, DuelPlayer** targets, int count, std::set<DuelPlayer*>* observers = 0);
 };
 
 }
@@ -8,6 +8,10 @@
 #include <event2/bufferevent.h>
 #include <event2/buffer.h>
 #include <event2/thread.h>
+#include "engine_pool.h"
+#include <deque>
+#include <new>
+#include <vector>
 
 namespace ygo {
 
@@ -56,6 +60,9 @@ struct CTOS_JoinGame {
 struct CTOS_Kick {
 	unsigned char pos;
 };
+struct CTOS_Features {
+	unsigned int flags;
+};
 struct STOC_ErrorMsg {
 	unsigned char msg;
 	unsigned int code;
@@ -97,24 +104,63 @@ struct STOC_HS_WatchChange {
 };
 
 class DuelMode;
+struct NetWorker;
 
 struct DuelPlayer {
 	unsigned short name[20];
 	DuelMode* game;
 	unsigned char type;
 	unsigned char state;
+	unsigned int features;
 	bufferevent* bev;
 	DuelPlayer() {
 		game = 0;
 		type = 0;
 		state = 0;
+		features = 0;
 		bev = 0;
 	}
 };
 
+// an encoded STOC packet shared by every connection it is sent to
+struct NetFrame {
+	std::atomic<int> refs;
+	unsigned short len;
+	char* data() {
+		return (char*)(this + 1);
+	}
+	static NetFrame* Create(unsigned char proto, const void* payload, size_t size) {
+		char* block = new char[sizeof(NetFrame) + size + 3];
+		NetFrame* frame = new (block) NetFrame;
+		frame->refs.store(1, std::memory_order_relaxed);
+		frame->len = size + 3;
+		char* p = frame->data();
+		BufferIO::WriteInt16(p, 1 + size);
+		BufferIO::WriteInt8(p, proto);
+		if(size)
+			memcpy(p, payload, size);
+		return frame;
+	}
+	void Retain() {
+		refs.fetch_add(1, std::memory_order_relaxed);
+	}
+	void Release() {
+		if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			this->~NetFrame();
+			delete[] (char*)this;
+		}
+	}
+};
+
+// a packet or disconnect (empty data) held back while the room is in the engine
+struct DeferredPacket {
+	bufferevent* bev;
+	std::vector<char> data;
+};
+
 class DuelMode {
 public:
-	DuelMode(): host_player(0), pduel(0), duel_stage(0) {}
+	DuelMode(): etimer(0), host_player(0), duel_stage(0), pduel(0), gameid(0), worker(0), busy(false), queue_depth(0) {}
 	virtual ~DuelMode() {}
 	virtual void Chat(DuelPlayer* dp, void* pdata, int len) {}
 	virtual void JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {}
@@ -144,6 +190,15 @@ public:
 	unsigned long pduel;
 	wchar_t name[20];
 	wchar_t pass[20];
+	unsigned int gameid;
+	NetWorker* worker;
+	EngineStrand strand;
+	bool busy;
+	std::deque<DeferredPacket> deferred;
+	std::vector<std::pair<DuelPlayer*, NetFrame*>> outbox;
+	std::atomic<int> queue_depth;
+
+	static std::mutex engine_mutex;
 };
 
 }
@@ -176,6 +231,7 @@ public:
 #define CTOS_HS_NOTREADY	0x23
 #define CTOS_HS_KICK		0x24
 #define CTOS_HS_START		0x25
+#define CTOS_FEATURES		0x30
 
 #define STOC_GAME_MSG		0x1
 #define STOC_ERROR_MSG		0x2
@@ -199,6 +255,12 @@ public:
 #define STOC_HS_PLAYER_CHANGE	0x21
 #define STOC_HS_WATCH_CHANGE	0x22
 
+// optional protocol extensions, announced by the client with CTOS_FEATURES
+#define FEATURE_DELTA_UPDATE	0x1
+
+// STOC_GAME_MSG carrying only the query fields changed since the last MSG_UPDATE_DATA
+#define MSG_UPDATE_DELTA	0xf0
+
 #define PLAYERCHANGE_OBSERVE	0x8
 #define PLAYERCHANGE_READY		0x9
 #define PLAYERCHANGE_NOTREADY	0xa
@@ -0,0 +1,127 @@
+#include "config.h"
+#include "replay_pack.h"
+#include <algorithm>
+
+static void PrintUsage(const char* name) {
+	fprintf(stderr, "Usage: %s archive.yrpk replay|directory ...\n", name);
+	fprintf(stderr, "       %s -l archive.yrpk\n", name);
+	fprintf(stderr, "       %s -x id archive.yrpk replay.yrp\n", name);
+	fprintf(stderr, "  -l           list the replays in the archive\n");
+	fprintf(stderr, "  -x id        write one replay out as an uncompressed .yrp\n");
+}
+
+static void AddReplays(const char* path, std::vector<std::string>& files) {
+	if(!FileSystem::IsDirExists(path)) {
+		files.push_back(path);
+		return;
+	}
+	std::string dir = path;
+	std::vector<std::string> names;
+	FileSystem::TraversalDir(path, [&](const char* name, bool isdir) {
+		if(!isdir && strrchr(name, '.') && !mystrncasecmp(strrchr(name, '.'), ".yrp", 4))
+			names.push_back(dir + "/" + name);
+	});
+	std::sort(names.begin(), names.end());
+	files.insert(files.end(), names.begin(), names.end());
+}
+
+static int CreatePack(const char* archive, const std::vector<std::string>& files) {
+	ygo::ReplayPack pack;
+	if(!pack.Create(fopen(archive, "wb"))) {
+		fprintf(stderr, "Cannot create %s\n", archive);
+		return EXIT_FAILURE;
+	}
+	unsigned long long in_size = 0;
+	unsigned int id = 0;
+	int failed = 0;
+	for(auto fit = files.begin(); fit != files.end(); ++fit) {
+		ygo::Replay replay;
+		wchar_t wname[256];
+		BufferIO::DecodeUTF8(fit->c_str(), wname);
+		if(!replay.OpenReplay(wname)) {
+			fprintf(stderr, "Cannot open %s\n", fit->c_str());
+			failed++;
+			continue;
+		}
+		if(!pack.Add(replay)) {
+			fprintf(stderr, "Cannot write %s\n", archive);
+			return EXIT_FAILURE;
+		}
+		unsigned long long size;
+		long long mtime;
+		if(FileSystem::GetFileInfo(fit->c_str(), size, mtime))
+			in_size += size;
+		printf("%u\t%s\n", id++, fit->c_str());
+	}
+	if(!pack.Finish()) {
+		fprintf(stderr, "Cannot write %s\n", archive);
+		return EXIT_FAILURE;
+	}
+	unsigned long long out_size = 0;
+	long long mtime;
+	FileSystem::GetFileInfo(archive, out_size, mtime);
+	fprintf(stderr, "%u replay(s), %llu bytes into %llu bytes, %d failed\n", id, in_size, out_size, failed);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int ListPack(const char* archive) {
+	ygo::ReplayPack pack;
+	std::vector<ygo::PackEntry> entries;
+	if(!pack.Open(fopen(archive, "rb")) || !pack.ReadEntries(entries)) {
+		fprintf(stderr, "Cannot read %s\n", archive);
+		return EXIT_FAILURE;
+	}
+	printf("id\tsize\tseed\tplayers\n");
+	for(size_t id = 0; id < entries.size(); ++id) {
+		const ygo::PackEntry& entry = entries[id];
+		printf("%u\t%u\t%u\t", (unsigned int)id, entry.header.datasize, entry.header.seed);
+		int players = (entry.header.flag & REPLAY_TAG) ? 4 : 2;
+		for(int p = 0; p < players; ++p) {
+			wchar_t wname[20];
+			char name[64];
+			BufferIO::CopyWStr(entry.players[p], wname, 20);
+			BufferIO::EncodeUTF8(wname, name);
+			printf(p ? ", %s" : "%s", name);
+		}
+		printf("\n");
+	}
+	return EXIT_SUCCESS;
+}
+
+static int ExtractReplay(unsigned int id, const char* archive, const char* output) {
+	ygo::ReplayPack pack;
+	ygo::ReplayHeader header;
+	std::vector<unsigned char> data;
+	if(!pack.Open(fopen(archive, "rb")) || !pack.Read(id, header, data)) {
+		fprintf(stderr, "Cannot read replay %u from %s\n", id, archive);
+		return EXIT_FAILURE;
+	}
+	FILE* fp = fopen(output, "wb");
+	if(!fp) {
+		fprintf(stderr, "Cannot create %s\n", output);
+		return EXIT_FAILURE;
+	}
+	fwrite(&header, sizeof(header), 1, fp);
+	if(!data.empty())
+		fwrite(data.data(), data.size(), 1, fp);
+	fclose(fp);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+#ifndef _WIN32
+	setlocale(LC_CTYPE, "UTF-8");
+#endif
+	if(argc == 3 && !strcmp(argv[1], "-l"))
+		return ListPack(argv[2]);
+	if(argc == 5 && !strcmp(argv[1], "-x"))
+		return ExtractReplay(strtoul(argv[2], 0, 10), argv[3], argv[4]);
+	if(argc < 3 || argv[1][0] == '-') {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	std::vector<std::string> files;
+	for(int i = 2; i < argc; ++i)
+		AddReplays(argv[i], files);
+	return CreatePack(argv[1], files);
+}
@@ -5,7 +5,7 @@ project "ygopro"
     kind "WindowedApp"
 
     files { "**.cpp", "**.cc", "**.c", "**.h" }
-    excludes { "lzma/**", "spmemvfs/**" }
+    excludes { "lzma/**", "spmemvfs/**", "server_main.cpp", "replay_main.cpp", "replay_runner.cpp", "pack_main.cpp" }
     includedirs { "../ocgcore" }
     links { "ocgcore", "clzma", "cspmemvfs", "Irrlicht", "freetype", "sqlite3", "event" }
     if USE_IRRKLANG then
@@ -48,3 +48,57 @@ project "ygopro"
             links { "irrklang" }
             libdirs { "../irrklang/bin/macosx-gcc" }
         end
+
+project "ygopro-server"
+    kind "ConsoleApp"
+
+    defines { "YGOPRO_SERVER_MODE" }
+    files { "data_manager.cpp", "deck_manager.cpp", "engine_pool.cpp", "field_delta.cpp", "field_mask.cpp",
+            "msg_desc.cpp", "netserver.cpp", "replay.cpp", "replay_journal.cpp", "replay_pack.cpp", "server_main.cpp", "single_duel.cpp", "startup_profile.cpp", "tag_duel.cpp", "*.h" }
+    includedirs { "../ocgcore" }
+    links { "ocgcore", "clzma", "cspmemvfs", "sqlite3", "event" }
+
+    configuration "windows"
+        includedirs { "../event/include", "../sqlite3" }
+        links { "lua", "ws2_32" }
+    configuration "not vs*"
+        buildoptions { "-std=c++14", "-fno-rtti" }
+    configuration "not windows"
+        links { "event_pthreads", "dl", "pthread" }
+    configuration "linux"
+        links { "lua5.3-c++" }
+    configuration "macosx"
+        links { "lua" }
+
+project "ygopro-replay"
+    kind "ConsoleApp"
+
+    defines { "YGOPRO_SERVER_MODE" }
+    files { "data_manager.cpp", "msg_desc.cpp", "replay.cpp", "replay_journal.cpp", "replay_main.cpp", "replay_pack.cpp", "replay_runner.cpp", "startup_profile.cpp", "*.h" }
+    includedirs { "../ocgcore" }
+    links { "ocgcore", "clzma", "cspmemvfs", "sqlite3" }
+
+    configuration "windows"
+        includedirs { "../event/include", "../sqlite3" }
+        links { "lua" }
+    configuration "not vs*"
+        buildoptions { "-std=c++14", "-fno-rtti" }
+    configuration "not windows"
+        links { "dl", "pthread" }
+    configuration "linux"
+        links { "lua5.3-c++" }
+    configuration "macosx"
+        links { "lua" }
+
+project "ygopro-pack"
+    kind "ConsoleApp"
+
+    defines { "YGOPRO_SERVER_MODE" }
+    files { "pack_main.cpp", "replay.cpp", "replay_journal.cpp", "replay_pack.cpp", "*.h" }
+    includedirs { "../ocgcore" }
+    links { "clzma" }
+
+    configuration "not vs*"
+        buildoptions { "-std=c++14", "-fno-rtti" }
+    configuration "not windows"
+        links { "pthread" }
@@ -1,20 +1,73 @@
 #include "replay.h"
+#include "replay_pack.h"
+#ifndef YGOPRO_SERVER_MODE
 #include "game.h"
+#endif
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/common.h"
 #include "lzma/LzmaLib.h"
+#include "lzma/LzmaEnc.h"
+#include <algorithm>
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
 
 namespace ygo {
 
+std::atomic<unsigned int> Replay::record_counter(1);
+
+// feeds the recorded blocks to the encoder without joining them
+struct ChunkInStream {
+	ISeqInStream s;
+	const std::vector<std::vector<unsigned char>>* chunks;
+	size_t chunk;
+	size_t pos;
+};
+static SRes ReadChunks(void* p, void* buf, size_t* size) {
+	ChunkInStream* in = (ChunkInStream*)p;
+	size_t len = 0;
+	while(in->chunk < in->chunks->size()) {
+		const std::vector<unsigned char>& block = (*in->chunks)[in->chunk];
+		if(in->pos < block.size()) {
+			len = std::min(*size, block.size() - in->pos);
+			memcpy(buf, &block[in->pos], len);
+			in->pos += len;
+			break;
+		}
+		in->chunk++;
+		in->pos = 0;
+	}
+	*size = len;
+	return SZ_OK;
+}
+struct VectorOutStream {
+	ISeqOutStream s;
+	std::vector<unsigned char>* out;
+};
+static size_t WriteVector(void* p, const void* buf, size_t size) {
+	VectorOutStream* out = (VectorOutStream*)p;
+	out->out->insert(out->out->end(), (const unsigned char*)buf, (const unsigned char*)buf + size);
+	return size;
+}
+static void* SzAlloc(void* p, size_t size) {
+	return malloc(size);
+}
+static void SzFree(void* p, void* address) {
+	free(address);
+}
+static ISzAlloc lzma_alloc = { SzAlloc, SzFree };
+
 Replay::Replay() {
 	is_recording = false;
 	is_replaying = false;
-	replay_data = new unsigned char[0x20000];
-	comp_data = new unsigned char[0x2000];
+	read_error = false;
+	pdata = 0;
+	replay_size = 0;
+	comp_size = 0;
+	record_size = 0;
+	record_name[0] = 0;
 }
 Replay::~Replay() {
-	delete[] replay_data;
-	delete[] comp_data;
 }
 void Replay::BeginRecord() {
 #ifdef XDG_ENVIRONMENT
@@ -29,114 +82,145 @@ void Replay::BeginRecord() {
 	if(!FileSystem::IsDirExists(L"./replay") && !FileSystem::MakeDir(L"./replay"))
 		return;
 #endif
+	journal.Close();
+	// every recording gets its own journal; a name already on disk belongs to
+	// another process or is a journal a crash left behind, and is skipped
+	wchar_t fname[256];
 #ifdef _WIN32
-	if(is_recording)
-		CloseHandle(recording_fp);
-	recording_fp = CreateFileW(L"./replay/_LastReplay.yrp", GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_WRITE_THROUGH, NULL);
+	HANDLE recording_fp = INVALID_HANDLE_VALUE;
+	for(int tries = 0; tries < 1000; ++tries) {
+		myswprintf(record_name, L"_LastReplay-%u", record_counter++);
+		myswprintf(fname, L"./replay/%ls.yrp", record_name);
+		recording_fp = CreateFileW(fname, GENERIC_WRITE, 0, NULL, CREATE_NEW, 0, NULL);
+		if(recording_fp != INVALID_HANDLE_VALUE || GetLastError() != ERROR_FILE_EXISTS)
+			break;
+	}
 	if(recording_fp == INVALID_HANDLE_VALUE)
 		return;
+	journal.Open(recording_fp);
 #else
-	if(is_recording)
-		fclose(fp);
+	FILE* recording_fp = 0;
+	for(int tries = 0; tries < 1000; ++tries) {
+		myswprintf(record_name, L"_LastReplay-%u", record_counter++);
+		myswprintf(fname, L"./replay/%ls.yrp", record_name);
+		char fname2[256];
+		BufferIO::EncodeUTF8(fname, fname2);
 #ifdef XDG_ENVIRONMENT
-	{ std::string new_replay = mainGame->FindDataFile("replay/_LastReplay.yrp", false); fp = fopen(new_replay.c_str(), "wb"); }
+		std::string new_replay = mainGame->FindDataFile(fname2, false);
 #else
-	fp = fopen("./replay/_LastReplay.yrp", "wb");
+		std::string new_replay = fname2;
 #endif
-	if(!fp)
+		int fd = open(new_replay.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if(fd >= 0) {
+			recording_fp = fdopen(fd, "wb");
+			if(!recording_fp)
+				close(fd);
+			break;
+		}
+		if(errno != EEXIST)
+			break;
+	}
+	if(!recording_fp)
 		return;
+	journal.Open(recording_fp);
 #endif
-	pdata = replay_data;
+	record_chunks.clear();
+	record_size = 0;
 	is_recording = true;
 }
 void Replay::WriteHeader(ReplayHeader& header) {
 	pheader = header;
-#ifdef _WIN32
-	DWORD size;
-	WriteFile(recording_fp, &header, sizeof(header), &size, NULL);
-#else
-	fwrite(&header, sizeof(header), 1, fp);
-	fflush(fp);
-#endif
+	ReplayHeader jheader = header;
+	jheader.flag |= REPLAY_JOURNAL;
+	journal.SetHeader(&jheader, sizeof(jheader));
 }
 void Replay::WriteData(const void* data, unsigned int length, bool flush) {
 	if(!is_recording)
 		return;
-	memcpy(pdata, data, length);
-	pdata += length;
-#ifdef _WIN32
-	DWORD size;
-	WriteFile(recording_fp, data, length, &size, NULL);
-#else
-	fwrite(data, length, 1, fp);
+	Append(data, length);
+	journal.Append(data, length);
 	if(flush)
-		fflush(fp);
-#endif
+		journal.Mark();
 }
 void Replay::WriteInt32(int data, bool flush) {
-	if(!is_recording)
-		return;
-	*((int*)(pdata)) = data;
-	pdata += 4;
-#ifdef _WIN32
-	DWORD size;
-	WriteFile(recording_fp, &data, sizeof(int), &size, NULL);
-#else
-	fwrite(&data, sizeof(int), 1, fp);
-	if(flush)
-		fflush(fp);
-#endif
+	WriteData(&data, sizeof(int), flush);
 }
 void Replay::WriteInt16(short data, bool flush) {
-	if(!is_recording)
-		return;
-	*((short*)(pdata)) = data;
-	pdata += 2;
-#ifdef _WIN32
-	DWORD size;
-	WriteFile(recording_fp, &data, sizeof(short), &size, NULL);
-#else
-	fwrite(&data, sizeof(short), 1, fp);
-	if(flush)
-		fflush(fp);
-#endif
+	WriteData(&data, sizeof(short), flush);
 }
 void Replay::WriteInt8(char data, bool flush) {
-	if(!is_recording)
-		return;
-	*pdata = data;
-	pdata++;
-#ifdef _WIN32
-	DWORD size;
-	WriteFile(recording_fp, &data, sizeof(char), &size, NULL);
-#else
-	fwrite(&data, sizeof(char), 1, fp);
-	if(flush)
-		fflush(fp);
-#endif
+	WriteData(&data, sizeof(char), flush);
 }
 void Replay::Flush() {
 	if(!is_recording)
 		return;
-#ifdef _WIN32
-#else
-	fflush(fp);
-#endif
+	journal.Mark();
+	journal.Commit();
 }
 void Replay::EndRecord() {
 	if(!is_recording)
 		return;
-#ifdef _WIN32
-	CloseHandle(recording_fp);
-#else
-	fclose(fp);
-#endif
-	pheader.datasize = pdata - replay_data;
+	journal.Close();
+	pheader.datasize = record_size;
 	pheader.flag |= REPLAY_COMPRESSED;
-	size_t propsize = 5;
-	comp_size = 0x1000;
-	LzmaCompress(comp_data, &comp_size, replay_data, pdata - replay_data, pheader.props, &propsize, 5, 1 << 24, 3, 0, 2, 32, 1);
+	Compress();
+	record_chunks.clear();
 	is_recording = false;
+	// the finished journal is replaced by a standard replay, kept as the last one
+	wchar_t record_file[64];
+	myswprintf(record_file, L"%ls.yrp", record_name);
+	SaveReplay(record_name);
+#ifdef WIN32
+	DeleteReplay(L"_LastReplay.yrp");
+#endif
+	if(!RenameReplay(record_file, L"_LastReplay.yrp"))
+		DeleteReplay(record_file);
+}
+void Replay::Append(const void* data, size_t length) {
+	const unsigned char* p = (const unsigned char*)data;
+	while(length) {
+		if(record_chunks.empty() || record_chunks.back().size() == REPLAY_CHUNK_SIZE) {
+			record_chunks.push_back(std::vector<unsigned char>());
+			record_chunks.back().reserve(REPLAY_CHUNK_SIZE);
+		}
+		std::vector<unsigned char>& block = record_chunks.back();
+		size_t len = std::min(length, (size_t)REPLAY_CHUNK_SIZE - block.size());
+		block.insert(block.end(), p, p + len);
+		p += len;
+		length -= len;
+		record_size += len;
+	}
+}
+void Replay::Compress() {
+	comp_data.clear();
+	comp_size = 0;
+	CLzmaEncHandle enc = LzmaEnc_Create(&lzma_alloc);
+	if(!enc)
+		return;
+	CLzmaEncProps props;
+	LzmaEncProps_Init(&props);
+	props.level = 5;
+	// the dictionary never has to be larger than the duel itself
+	props.dictSize = 1 << 12;
+	while(props.dictSize < record_size && props.dictSize < (1 << 24))
+		props.dictSize <<= 1;
+	props.lc = 3;
+	props.lp = 0;
+	props.pb = 2;
+	props.fb = 32;
+	props.numThreads = 1;
+	ChunkInStream in = { { ReadChunks }, &record_chunks, 0, 0 };
+	VectorOutStream out = { { WriteVector }, &comp_data };
+	SizeT propsize = LZMA_PROPS_SIZE;
+	SRes res = LzmaEnc_SetProps(enc, &props);
+	if(res == SZ_OK)
+		res = LzmaEnc_WriteProperties(enc, pheader.props, &propsize);
+	if(res == SZ_OK)
+		res = LzmaEnc_Encode(enc, &out.s, &in.s, NULL, &lzma_alloc, &lzma_alloc);
+	LzmaEnc_Destroy(enc, &lzma_alloc, &lzma_alloc);
+	if(res != SZ_OK)
+		comp_data.clear();
+	comp_size = comp_data.size();
 }
 void Replay::SaveReplay(const wchar_t* name) {
 #ifdef XDG_ENVIRONMENT
@@ -167,10 +251,12 @@ void Replay::SaveReplay(const wchar_t* name) {
 	if(!fp)
 		return;
 	fwrite(&pheader, sizeof(pheader), 1, fp);
-	fwrite(comp_data, comp_size, 1, fp);
+	fwrite(comp_data.data(), comp_size, 1, fp);
 	fclose(fp);
 }
-bool Replay::OpenReplay(const wchar_t* name) {
+// the file itself, or the one with that name in the replay directory
+static FILE* OpenReplayFile(const wchar_t* name) {
+	FILE* fp;
 #ifdef WIN32
 	fp = _wfopen(name, L"rb");
 #else
@@ -197,24 +283,67 @@ bool Replay::OpenReplay(const wchar_t* name) {
 #endif
 #endif
 	}
+	return fp;
+}
+bool Replay::OpenReplay(const wchar_t* name) {
+	const wchar_t* pack_name = wcsstr(name, L".yrpk/");
+	if(pack_name) {
+		// <pack>.yrpk/<id>
+		wchar_t file[256];
+		size_t len = std::min((size_t)(pack_name - name) + 5, sizeof(file) / sizeof(wchar_t) - 1);
+		wcsncpy(file, name, len);
+		file[len] = 0;
+		ReplayPack pack;
+		if(!pack.Open(OpenReplayFile(file)) || !pack.Read(wcstoul(pack_name + 6, 0, 10), pheader, replay_data))
+			return false;
+		comp_data.clear();
+		comp_size = 0;
+		replay_size = replay_data.size();
+		pdata = replay_data.data();
+		read_error = false;
+		is_replaying = true;
+		return true;
+	}
+	fp = OpenReplayFile(name);
 	if(!fp)
 		return false;
 	if(fread(&pheader, sizeof(pheader), 1, fp) < 1) {
 		fclose(fp);
 		return false;
 	}
-	if(pheader.flag & REPLAY_COMPRESSED) {
-		comp_size = fread(comp_data, 1, 0x1000, fp);
+	if(pheader.flag & REPLAY_JOURNAL) {
+		// an unfinished recording, keep whatever was committed
+		ReplayJournal::Recover(fp, replay_data);
 		fclose(fp);
+		pheader.flag &= ~(REPLAY_JOURNAL | REPLAY_COMPRESSED);
+		comp_data.clear();
+		comp_size = 0;
+		replay_size = replay_data.size();
+		pdata = replay_data.data();
+		read_error = false;
+		is_replaying = true;
+		return true;
+	}
+	std::vector<unsigned char>& file_data = (pheader.flag & REPLAY_COMPRESSED) ? comp_data : replay_data;
+	file_data.clear();
+	unsigned char buf[0x1000];
+	size_t len;
+	while((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+		file_data.insert(file_data.end(), buf, buf + len);
+	fclose(fp);
+	comp_size = file_data.size();
+	if(pheader.flag & REPLAY_COMPRESSED) {
+		if(pheader.datasize > REPLAY_MAX_SIZE)
+			return false;
+		replay_data.resize(pheader.datasize);
 		replay_size = pheader.datasize;
-		if(LzmaUncompress(replay_data, &replay_size, comp_data, &comp_size, pheader.props, 5) != SZ_OK)
+		if(LzmaUncompress(replay_data.data(), &replay_size, comp_data.data(), &comp_size, pheader.props, 5) != SZ_OK)
 			return false;
 	} else {
-		comp_size = fread(replay_data, 1, 0x20000, fp);
-		fclose(fp);
 		replay_size = comp_size;
 	}
-	pdata = replay_data;
+	pdata = replay_data.data();
+	read_error = false;
 	is_replaying = true;
 	return true;
 }
@@ -238,7 +367,10 @@ bool Replay::CheckReplay(const wchar_t* name) {
 	ReplayHeader rheader;
 	size_t count = fread(&rheader, sizeof(ReplayHeader), 1, rfp);
 	fclose(rfp);
-	return count == 1 && rheader.id == 0x31707279 && rheader.version >= 0x12d0;
+	return count == 1 && CheckHeader(rheader);
+}
+bool Replay::CheckHeader(const ReplayHeader& header) {
+	return header.id == 0x31707279 && header.version >= 0x12d0;
 }
 bool Replay::DeleteReplay(const wchar_t* name) {
 	wchar_t fname[256];
@@ -282,10 +414,10 @@ bool Replay::RenameReplay(const wchar_t* oldname, const wchar_t* newname) {
 #endif
 }
 bool Replay::ReadNextResponse(unsigned char resp[64]) {
-	if(pdata - replay_data >= (int)replay_size)
+	if(pdata - replay_data.data() >= (int)replay_size)
 		return false;
 	int len = *pdata++;
-	if(len > 64)
+	if(len > 64 || pdata - replay_data.data() + len > (int)replay_size)
 		return false;
 	memcpy(resp, pdata, len);
 	pdata += len;
@@ -301,30 +433,46 @@ void Replay::ReadName(wchar_t* data) {
 void Replay::ReadData(void* data, unsigned int length) {
 	if(!is_replaying)
 		return;
+	if(!CanRead(length)) {
+		memset(data, 0, length);
+		return;
+	}
 	memcpy(data, pdata, length);
 	pdata += length;
 }
 int Replay::ReadInt32() {
-	if(!is_replaying)
+	if(!is_replaying || !CanRead(4))
 		return -1;
-	int ret = *((int*)pdata);
+	int ret;
+	memcpy(&ret, pdata, 4);
 	pdata += 4;
 	return ret;
 }
 short Replay::ReadInt16() {
-	if(!is_replaying)
+	if(!is_replaying || !CanRead(2))
 		return -1;
-	short ret = *((short*)pdata);
+	short ret;
+	memcpy(&ret, pdata, 2);
 	pdata += 2;
 	return ret;
 }
 char Replay::ReadInt8() {
-	if(!is_replaying)
+	if(!is_replaying || !CanRead(1))
 		return -1;
 	return *pdata++;
 }
 void Replay::Rewind() {
-	pdata = replay_data;
+	pdata = replay_data.data();
+	read_error = false;
+}
+// a read past the end sets read_error and leaves pdata at the end
+bool Replay::CanRead(size_t length) {
+	size_t left = replay_data.data() + replay_size - pdata;
+	if(length <= left)
+		return true;
+	pdata += left;
+	read_error = true;
+	return false;
 }
 
 }
@@ -2,7 +2,10 @@
 #define REPLAY_H
 
 #include "config.h"
+#include "replay_journal.h"
+#include <atomic>
 #include <time.h>
+#include <vector>
 
 namespace ygo {
 
@@ -10,6 +13,13 @@ namespace ygo {
 #define REPLAY_TAG			0x2
 #define REPLAY_DECODED		0x4
 #define REPLAY_SINGLE_MODE	0x8
+// unfinished recording, the data is in ReplayJournal frames
+#define REPLAY_JOURNAL		0x80
+
+// size of one block of the recorded stream
+#define REPLAY_CHUNK_SIZE	0x10000
+// a replay claiming more data than this is corrupt
+#define REPLAY_MAX_SIZE		0x1000000
 
 struct ReplayHeader {
 	unsigned int id;
@@ -36,6 +46,7 @@ public:
 	void SaveReplay(const wchar_t* name);
 	bool OpenReplay(const wchar_t* name);
 	static bool CheckReplay(const wchar_t* name);
+	static bool CheckHeader(const ReplayHeader& header);
 	static bool DeleteReplay(const wchar_t* name);
 	static bool RenameReplay(const wchar_t* oldname, const wchar_t* newname);
 	bool ReadNextResponse(unsigned char resp[64]);
@@ -49,16 +60,28 @@ public:
 
 	FILE* fp;
 	ReplayHeader pheader;
-#ifdef _WIN32
-	HANDLE recording_fp;
-#endif
-	unsigned char* replay_data;
-	unsigned char* comp_data;
+	std::vector<unsigned char> replay_data;
+	std::vector<unsigned char> comp_data;
 	unsigned char* pdata;
 	size_t replay_size;
 	size_t comp_size;
 	bool is_recording;
 	bool is_replaying;
+	// set when a Read* ran past the end of the data
+	bool read_error;
+
+private:
+	bool CanRead(size_t length);
+	void Append(const void* data, size_t length);
+	void Compress();
+
+	// the stream being recorded, in blocks of REPLAY_CHUNK_SIZE
+	std::vector<std::vector<unsigned char>> record_chunks;
+	size_t record_size;
+	ReplayJournal journal;
+	// the journal is ./replay/<record_name>.yrp until the recording ends
+	wchar_t record_name[32];
+	static std::atomic<unsigned int> record_counter;
 };
 
 }
@@ -0,0 +1,236 @@
+#include "replay_catalog.h"
+#include "replay_pack.h"
+#include "lzma/LzmaLib.h"
+#include <algorithm>
+
+namespace ygo {
+
+ReplayCatalog replayCatalog;
+
+#define CATALOG_ID		0x63707279
+#define CATALOG_VERSION	1
+
+struct CatalogHeader {
+	unsigned int id;
+	unsigned int version;
+	unsigned int count;
+};
+// followed by name_length bytes of UTF-8
+struct CatalogRecord {
+	ReplayHeader header;
+	unsigned int valid;
+	unsigned int name_length;
+	unsigned long long size;
+	long long mtime;
+	unsigned short players[4][20];
+};
+
+static FILE* OpenFile(const wchar_t* file, const wchar_t* mode) {
+#ifdef _WIN32
+	return _wfopen(file, mode);
+#else
+	char file2[1024];
+	char mode2[8];
+	BufferIO::EncodeUTF8(file, file2);
+	BufferIO::EncodeUTF8(mode, mode2);
+	return fopen(file2, mode2);
+#endif
+}
+
+void ReplayCatalog::Refresh(const wchar_t* dir) {
+	std::wstring catalog_file = std::wstring(dir) + L"/_Catalog.dat";
+	if(catalog_dir != dir) {
+		catalog_dir = dir;
+		Load(catalog_file.c_str());
+	}
+	std::vector<ReplayInfo> found;
+	bool changed = false;
+	FileSystem::TraversalDir(dir, [&](const wchar_t* name, bool isdir) {
+		if(isdir || !wcsrchr(name, '.'))
+			return;
+		if(!mywcsncasecmp(wcsrchr(name, '.'), L".yrpk", 5)) {
+			if(AddPack(dir, name, found))
+				changed = true;
+			return;
+		}
+		if(mywcsncasecmp(wcsrchr(name, '.'), L".yrp", 4))
+			return;
+		std::wstring file = std::wstring(dir) + L"/" + name;
+		ReplayInfo info;
+		if(!FileSystem::GetFileInfo(file.c_str(), info.size, info.mtime))
+			return;
+		auto iit = index.find(name);
+		if(iit != index.end() && entries[iit->second].size == info.size && entries[iit->second].mtime == info.mtime) {
+			found.push_back(entries[iit->second]);
+			return;
+		}
+		info.name = name;
+		ReadInfo(file.c_str(), info);
+		found.push_back(info);
+		changed = true;
+	});
+	if(found.size() != entries.size())
+		changed = true;
+	entries.swap(found);
+	index.clear();
+	for(size_t i = 0; i < entries.size(); ++i)
+		index[entries[i].name] = i;
+	if(changed)
+		Save(catalog_file.c_str());
+}
+const ReplayInfo* ReplayCatalog::Find(const wchar_t* name) const {
+	auto iit = index.find(name);
+	if(iit == index.end())
+		return 0;
+	return &entries[iit->second];
+}
+void ReplayCatalog::Rename(const wchar_t* oldname, const wchar_t* newname) {
+	auto iit = index.find(oldname);
+	if(iit == index.end())
+		return;
+	size_t pos = iit->second;
+	index.erase(iit);
+	entries[pos].name = newname;
+	index[newname] = pos;
+}
+void ReplayCatalog::Load(const wchar_t* file) {
+	entries.clear();
+	index.clear();
+	FILE* fp = OpenFile(file, L"rb");
+	if(!fp)
+		return;
+	std::vector<unsigned char> data;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if(size > 0) {
+		data.resize(size);
+		if(fread(data.data(), size, 1, fp) != 1)
+			data.clear();
+	}
+	fclose(fp);
+	CatalogHeader cheader;
+	if(data.size() < sizeof(cheader))
+		return;
+	memcpy(&cheader, data.data(), sizeof(cheader));
+	if(cheader.id != CATALOG_ID || cheader.version != CATALOG_VERSION)
+		return;
+	size_t pos = sizeof(cheader);
+	for(unsigned int i = 0; i < cheader.count; ++i) {
+		CatalogRecord record;
+		if(data.size() - pos < sizeof(record))
+			break;
+		memcpy(&record, &data[pos], sizeof(record));
+		pos += sizeof(record);
+		if(record.name_length >= 1024 || data.size() - pos < record.name_length)
+			break;
+		char name[1024];
+		memcpy(name, &data[pos], record.name_length);
+		name[record.name_length] = 0;
+		pos += record.name_length;
+		wchar_t wname[1024];
+		BufferIO::DecodeUTF8(name, wname);
+		ReplayInfo info;
+		info.name = wname;
+		info.size = record.size;
+		info.mtime = record.mtime;
+		info.valid = !!record.valid;
+		info.header = record.header;
+		for(int p = 0; p < 4; ++p)
+			BufferIO::CopyWStr(record.players[p], info.players[p], 20);
+		index[info.name] = entries.size();
+		entries.push_back(info);
+	}
+}
+void ReplayCatalog::Save(const wchar_t* file) {
+	std::vector<unsigned char> data;
+	CatalogHeader cheader;
+	cheader.id = CATALOG_ID;
+	cheader.version = CATALOG_VERSION;
+	cheader.count = (unsigned int)entries.size();
+	data.insert(data.end(), (unsigned char*)&cheader, (unsigned char*)&cheader + sizeof(cheader));
+	for(auto eit = entries.begin(); eit != entries.end(); ++eit) {
+		char name[1024];
+		CatalogRecord record;
+		memset(&record, 0, sizeof(record));
+		record.header = eit->header;
+		record.valid = eit->valid;
+		record.name_length = BufferIO::EncodeUTF8(eit->name.c_str(), name);
+		record.size = eit->size;
+		record.mtime = eit->mtime;
+		for(int p = 0; p < 4; ++p)
+			BufferIO::CopyWStr(eit->players[p], record.players[p], 20);
+		data.insert(data.end(), (unsigned char*)&record, (unsigned char*)&record + sizeof(record));
+		data.insert(data.end(), (unsigned char*)name, (unsigned char*)name + record.name_length);
+	}
+	FILE* fp = OpenFile(file, L"wb");
+	if(!fp)
+		return;
+	fwrite(data.data(), data.size(), 1, fp);
+	fclose(fp);
+}
+// Entries of a pack are named <pack>/<id> and carry the size and mtime of the
+// pack, so an unchanged pack is listed from the catalog without reading its index.
+// Returns whether the index was read.
+bool ReplayCatalog::AddPack(const wchar_t* dir, const wchar_t* name, std::vector<ReplayInfo>& found) {
+	std::wstring file = std::wstring(dir) + L"/" + name;
+	unsigned long long size;
+	long long mtime;
+	if(!FileSystem::GetFileInfo(file.c_str(), size, mtime))
+		return false;
+	std::wstring prefix = std::wstring(name) + L"/";
+	auto iit = index.find(prefix + L"0");
+	if(iit != index.end() && entries[iit->second].size == size && entries[iit->second].mtime == mtime) {
+		for(unsigned int id = 0; (iit = index.find(prefix + std::to_wstring(id))) != index.end(); ++id)
+			found.push_back(entries[iit->second]);
+		return false;
+	}
+	ReplayPack pack;
+	std::vector<PackEntry> pack_entries;
+	if(!pack.Open(OpenFile(file.c_str(), L"rb")) || !pack.ReadEntries(pack_entries))
+		return false;
+	for(size_t id = 0; id < pack_entries.size(); ++id) {
+		ReplayInfo info;
+		info.name = prefix + std::to_wstring(id);
+		info.size = size;
+		info.mtime = mtime;
+		info.valid = Replay::CheckHeader(pack_entries[id].header);
+		info.header = pack_entries[id].header;
+		for(int p = 0; p < 4; ++p)
+			BufferIO::CopyWStr(pack_entries[id].players[p], info.players[p], 20);
+		found.push_back(info);
+	}
+	return true;
+}
+void ReplayCatalog::ReadInfo(const wchar_t* file, ReplayInfo& info) {
+	info.valid = false;
+	memset(&info.header, 0, sizeof(info.header));
+	memset(info.players, 0, sizeof(info.players));
+	FILE* fp = OpenFile(file, L"rb");
+	if(!fp)
+		return;
+	if(fread(&info.header, sizeof(info.header), 1, fp) != 1 || !Replay::CheckHeader(info.header)) {
+		fclose(fp);
+		return;
+	}
+	info.valid = true;
+	// the player names open the stream, a few KB of it is plenty
+	unsigned char buf[0x1000];
+	size_t buf_size = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	unsigned short names[4][20] = {};
+	size_t name_size = (info.header.flag & REPLAY_TAG) ? sizeof(names) : sizeof(names) / 2;
+	if(info.header.flag & REPLAY_COMPRESSED) {
+		LzmaUncompress((unsigned char*)names, &name_size, buf, &buf_size, info.header.props, 5);
+	} else {
+		size_t skip = (info.header.flag & REPLAY_JOURNAL) ? sizeof(JournalFrame) : 0;
+		if(buf_size > skip)
+			memcpy(names, buf + skip, std::min(name_size, buf_size - skip));
+	}
+	for(int p = 0; p < 4; ++p) {
+		names[p][19] = 0;
+		BufferIO::CopyWStr(names[p], info.players[p], 20);
+	}
+}
+
+}
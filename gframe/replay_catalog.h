@@ -0,0 +1,46 @@
+#ifndef REPLAY_CATALOG_H
+#define REPLAY_CATALOG_H
+
+#include "config.h"
+#include "replay.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace ygo {
+
+struct ReplayInfo {
+	std::wstring name;
+	unsigned long long size;
+	long long mtime;
+	bool valid;
+	ReplayHeader header;
+	wchar_t players[4][20];
+};
+
+// Headers and player names of the stored replays, including those in replay
+// packs. The catalog is kept in the replay directory and a file is only read
+// again when its size or mtime changed.
+class ReplayCatalog {
+public:
+	void Refresh(const wchar_t* dir);
+	const ReplayInfo* Find(const wchar_t* name) const;
+	void Rename(const wchar_t* oldname, const wchar_t* newname);
+
+	std::vector<ReplayInfo> entries;
+
+private:
+	void Load(const wchar_t* file);
+	void Save(const wchar_t* file);
+	bool AddPack(const wchar_t* dir, const wchar_t* name, std::vector<ReplayInfo>& found);
+	static void ReadInfo(const wchar_t* file, ReplayInfo& info);
+
+	std::wstring catalog_dir;
+	std::unordered_map<std::wstring, size_t> index;
+};
+
+extern ReplayCatalog replayCatalog;
+
+}
+
+#endif //REPLAY_CATALOG_H
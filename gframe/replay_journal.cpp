@@ -0,0 +1,176 @@
+#include "replay_journal.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace ygo {
+
+std::mutex ReplayJournal::writer_mutex;
+std::condition_variable ReplayJournal::writer_cond;
+std::condition_variable ReplayJournal::done_cond;
+std::vector<ReplayJournal*> ReplayJournal::journals;
+ReplayJournal* ReplayJournal::current = 0;
+bool ReplayJournal::writer_running = false;
+bool ReplayJournal::writer_wake = false;
+
+ReplayJournal::ReplayJournal() {
+	file = 0;
+	is_open = false;
+	marked = 0;
+	requested = false;
+}
+ReplayJournal::~ReplayJournal() {
+	Close();
+}
+#ifdef _WIN32
+void ReplayJournal::Open(HANDLE file) {
+#else
+void ReplayJournal::Open(FILE* file) {
+#endif
+	Close();
+	this->file = file;
+	header.clear();
+	pending.clear();
+	marked = 0;
+	requested = false;
+	is_open = true;
+	std::lock_guard<std::mutex> lock(writer_mutex);
+	journals.push_back(this);
+	if(!writer_running) {
+		writer_running = true;
+		std::thread(WriterThread).detach();
+	}
+}
+void ReplayJournal::Close() {
+	if(!is_open)
+		return;
+	{
+		std::unique_lock<std::mutex> lock(writer_mutex);
+		journals.erase(std::find(journals.begin(), journals.end(), this));
+		done_cond.wait(lock, [this] { return current != this; });
+	}
+	WriteBatch(true);
+#ifdef _WIN32
+	CloseHandle(file);
+#else
+	fclose(file);
+#endif
+	file = 0;
+	is_open = false;
+}
+void ReplayJournal::SetHeader(const void* data, size_t length) {
+	std::lock_guard<std::mutex> lock(mutex);
+	header.assign((const unsigned char*)data, (const unsigned char*)data + length);
+}
+void ReplayJournal::Append(const void* data, size_t length) {
+	std::lock_guard<std::mutex> lock(mutex);
+	pending.insert(pending.end(), (const unsigned char*)data, (const unsigned char*)data + length);
+}
+void ReplayJournal::Mark() {
+	mutex.lock();
+	marked = pending.size();
+	bool wake = marked >= JOURNAL_BATCH_SIZE && !requested;
+	if(wake)
+		requested = true;
+	mutex.unlock();
+	if(wake) {
+		std::lock_guard<std::mutex> lock(writer_mutex);
+		writer_wake = true;
+		writer_cond.notify_one();
+	}
+}
+void ReplayJournal::Commit() {
+	mutex.lock();
+	bool wake = (marked || !header.empty()) && !requested;
+	if(wake)
+		requested = true;
+	mutex.unlock();
+	if(wake) {
+		std::lock_guard<std::mutex> lock(writer_mutex);
+		writer_wake = true;
+		writer_cond.notify_one();
+	}
+}
+// FNV-1a
+unsigned int ReplayJournal::Checksum(const unsigned char* data, size_t length) {
+	unsigned int hash = 2166136261u;
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+bool ReplayJournal::Recover(FILE* fp, std::vector<unsigned char>& data) {
+	data.clear();
+	JournalFrame frame;
+	std::vector<unsigned char> buf;
+	while(fread(&frame, sizeof(frame), 1, fp) == 1) {
+		// a torn frame header can hold any size
+		if(frame.size == 0 || frame.size > 0x1000000)
+			break;
+		buf.resize(frame.size);
+		if(fread(buf.data(), 1, frame.size, fp) < frame.size)
+			break;
+		if(Checksum(buf.data(), frame.size) != frame.check)
+			break;
+		data.insert(data.end(), buf.begin(), buf.end());
+	}
+	return !data.empty();
+}
+void ReplayJournal::WriteBatch(bool all) {
+	std::vector<unsigned char> head;
+	std::vector<unsigned char> batch;
+	mutex.lock();
+	head.swap(header);
+	size_t length = all ? pending.size() : marked;
+	if(length == pending.size()) {
+		batch.swap(pending);
+	} else {
+		batch.assign(pending.begin(), pending.begin() + length);
+		pending.erase(pending.begin(), pending.begin() + length);
+	}
+	marked = 0;
+	requested = false;
+	mutex.unlock();
+	if(head.empty() && batch.empty())
+		return;
+	if(!head.empty())
+		WriteRaw(head.data(), head.size());
+	if(!batch.empty()) {
+		JournalFrame frame;
+		frame.size = (unsigned int)batch.size();
+		frame.check = Checksum(batch.data(), batch.size());
+		WriteRaw(&frame, sizeof(frame));
+		WriteRaw(batch.data(), batch.size());
+	}
+#ifndef _WIN32
+	fflush(file);
+#endif
+}
+void ReplayJournal::WriteRaw(const void* data, size_t length) {
+#ifdef _WIN32
+	DWORD size;
+	WriteFile(file, data, (DWORD)length, &size, NULL);
+#else
+	fwrite(data, length, 1, file);
+#endif
+}
+void ReplayJournal::WriterThread() {
+	std::unique_lock<std::mutex> lock(writer_mutex);
+	while(!journals.empty()) {
+		writer_cond.wait_for(lock, std::chrono::milliseconds(JOURNAL_FLUSH_INTERVAL), [] { return writer_wake; });
+		writer_wake = false;
+		for(size_t i = 0; i < journals.size(); ++i) {
+			ReplayJournal* journal = journals[i];
+			current = journal;
+			lock.unlock();
+			journal->WriteBatch(false);
+			lock.lock();
+			current = 0;
+			done_cond.notify_all();
+		}
+	}
+	writer_running = false;
+}
+
+}
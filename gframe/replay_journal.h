@@ -0,0 +1,78 @@
+#ifndef REPLAY_JOURNAL_H
+#define REPLAY_JOURNAL_H
+
+#include "config.h"
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+namespace ygo {
+
+// a commit is requested as soon as this many bytes are ready
+#define JOURNAL_BATCH_SIZE		0x1000
+// ready bytes never wait longer than this (ms)
+#define JOURNAL_FLUSH_INTERVAL	200
+
+// Every commit is written as one frame: the header below followed by
+// size bytes of the record stream.
+struct JournalFrame {
+	unsigned int size;
+	unsigned int check;
+};
+
+// Writes a recorded replay to disk off the recording thread. Records are
+// buffered and a shared writer thread commits them in frames, so a journal
+// cut short by a crash is still readable up to its last complete frame.
+class ReplayJournal {
+public:
+	ReplayJournal();
+	~ReplayJournal();
+#ifdef _WIN32
+	void Open(HANDLE file);
+#else
+	void Open(FILE* file);
+#endif
+	void Close();
+	bool IsOpen() const {
+		return is_open;
+	}
+	// written once, unframed, ahead of the first frame
+	void SetHeader(const void* data, size_t length);
+	void Append(const void* data, size_t length);
+	// everything appended so far may be committed
+	void Mark();
+	// asks the writer to commit the marked bytes now
+	void Commit();
+
+	static unsigned int Checksum(const unsigned char* data, size_t length);
+	static bool Recover(FILE* fp, std::vector<unsigned char>& data);
+
+private:
+	void WriteBatch(bool all);
+	void WriteRaw(const void* data, size_t length);
+	static void WriterThread();
+
+#ifdef _WIN32
+	HANDLE file;
+#else
+	FILE* file;
+#endif
+	bool is_open;
+	std::mutex mutex;
+	std::vector<unsigned char> header;
+	std::vector<unsigned char> pending;
+	size_t marked;
+	bool requested;
+
+	static std::mutex writer_mutex;
+	static std::condition_variable writer_cond;
+	static std::condition_variable done_cond;
+	static std::vector<ReplayJournal*> journals;
+	static ReplayJournal* current;
+	static bool writer_running;
+	static bool writer_wake;
+};
+
+}
+
+#endif //REPLAY_JOURNAL_H
@@ -0,0 +1,143 @@
+#include "config.h"
+#include "replay_runner.h"
+#include "replay_pack.h"
+#include "data_manager.h"
+#include "msg_desc.h"
+#include "startup_profile.h"
+#include <chrono>
+
+int enable_log = 0;
+bool exit_on_return = false;
+bool open_file = false;
+wchar_t open_file_name[256] = L"";
+bool bot_mode = false;
+bool prefer_expansion_script = false;
+
+static void PrintUsage(const char* name) {
+	fprintf(stderr, "Usage: %s [-j threads] [-c directory] [-e database] [-x] [-l] [--profile-startup[=file]] replay|pack|directory ...\n", name);
+	fprintf(stderr, "  -j threads   replays run at once (default: one per core)\n");
+	fprintf(stderr, "  -c directory compare against the scripts of another game directory\n");
+	fprintf(stderr, "  -e database  load an extra card database, may be repeated\n");
+	fprintf(stderr, "  -x           prefer scripts in ./expansions\n");
+	fprintf(stderr, "  -l           print script error logs to stderr\n");
+	fprintf(stderr, "  --profile-startup[=file]\n");
+	fprintf(stderr, "               print the time of each startup phase, and write it to file as json\n");
+}
+
+static void LoadExpansions() {
+	FileSystem::TraversalDir("./expansions", [](const char* name, bool isdir) {
+		if(!isdir && strrchr(name, '.') && !mystrncasecmp(strrchr(name, '.'), ".cdb", 4)) {
+			char fpath[1024];
+			snprintf(fpath, sizeof(fpath), "./expansions/%s", name);
+			ygo::dataManager.QueueDB(fpath);
+		}
+	});
+}
+
+static const char* MessageName(int msg) {
+	if(msg < 0)
+		return "end";
+	const ygo::MessageDesc* desc = ygo::MessageDesc::Get(msg);
+	return desc ? desc->name : "unknown";
+}
+
+static bool IsPack(const char* name) {
+	return strrchr(name, '.') && !mystrncasecmp(strrchr(name, '.'), ".yrpk", 5);
+}
+
+static void AddPack(const std::string& file, std::vector<std::string>& files) {
+	ygo::ReplayPack pack;
+	if(!pack.Open(fopen(file.c_str(), "rb"))) {
+		files.push_back(file);
+		return;
+	}
+	for(unsigned int id = 0; id < pack.GetCount(); ++id)
+		files.push_back(file + "/" + std::to_string(id));
+}
+
+static void AddReplays(const char* path, std::vector<std::string>& files) {
+	if(!FileSystem::IsDirExists(path)) {
+		if(IsPack(path))
+			AddPack(path, files);
+		else
+			files.push_back(path);
+		return;
+	}
+	std::string dir = path;
+	FileSystem::TraversalDir(path, [&](const char* name, bool isdir) {
+		if(isdir || !strrchr(name, '.'))
+			return;
+		if(IsPack(name))
+			AddPack(dir + "/" + name, files);
+		else if(!mystrncasecmp(strrchr(name, '.'), ".yrp", 4))
+			files.push_back(dir + "/" + name);
+	});
+}
+
+int main(int argc, char* argv[]) {
+#ifndef _WIN32
+	setlocale(LC_CTYPE, "UTF-8");
+#endif
+	int threads = std::thread::hardware_concurrency();
+	std::vector<const char*> extra_db;
+	std::vector<std::string> files;
+	const char* candidate = 0;
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "-j") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-c") && i + 1 < argc) {
+			candidate = argv[++i];
+		} else if(!strcmp(argv[i], "-e") && i + 1 < argc) {
+			extra_db.push_back(argv[++i]);
+		} else if(!strcmp(argv[i], "-x")) {
+			prefer_expansion_script = true;
+		} else if(!strcmp(argv[i], "-l")) {
+			enable_log = 1;
+		} else if(ygo::StartupProfile::ParseArg(argv[i])) {
+		} else if(argv[i][0] == '-') {
+			PrintUsage(argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			AddReplays(argv[i], files);
+		}
+	}
+	if(files.empty()) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	ygo::StartupProfile::Begin("startup");
+	ygo::ProfileScope phase("card databases");
+	LoadExpansions();
+	if(!ygo::dataManager.QueueDB("cards.cdb")) {
+		fprintf(stderr, "Failed to load card database (cards.cdb)!\n");
+		return EXIT_FAILURE;
+	}
+	for(auto dbit = extra_db.begin(); dbit != extra_db.end(); ++dbit) {
+		if(!ygo::dataManager.QueueDB(*dbit))
+			fprintf(stderr, "Failed to load card database (%s)!\n", *dbit);
+	}
+	if(!ygo::dataManager.LoadQueuedDBs())
+		fprintf(stderr, "Failed to read some card databases!\n");
+	phase.End();
+	ygo::ReplayRunner::Init();
+	ygo::StartupProfile::Report();
+	int failed = 0;
+	auto start = std::chrono::steady_clock::now();
+	printf("file\tstatus\twinner\treason\tturns\tsteps\tms%s\n", candidate ? "\tdivergence" : "");
+	ygo::ReplayRunner::RunAll(files, threads, candidate, [&](const ygo::ReplayResult& result) {
+		printf("%s\t%s\t%d\t%d\t%d\t%d\t%.1f", result.file.c_str(), result.status,
+		       result.winner, result.reason, result.turns, result.steps, result.wall_ms);
+		if(candidate && result.diverge_step >= 0)
+			printf("\tmessage %d, turn %d, after %s: reference %s, candidate %s", result.diverge_step, result.diverge_turn,
+			       MessageName(result.last_msg), MessageName(result.reference_msg), MessageName(result.candidate_msg));
+		else if(candidate)
+			printf("\t-");
+		printf("\n");
+		fflush(stdout);
+		if(result.failed)
+			failed++;
+	});
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%d replay(s) in %.1f s, %d failed\n", (int)files.size(), elapsed, failed);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
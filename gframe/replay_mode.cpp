@@ -2,6 +2,7 @@
 #include "duelclient.h"
 #include "game.h"
 #include "single_mode.h"
+#include "msg_desc.h"
 #include "../ocgcore/common.h"
 #include "../ocgcore/mtrandom.h"
 
@@ -19,6 +20,9 @@ bool ReplayMode::exit_pending = false;
 int ReplayMode::skip_turn = 0;
 int ReplayMode::current_step = 0;
 int ReplayMode::skip_step = 0;
+int ReplayMode::seek_step = 0;
+ReplayView ReplayMode::view;
+size_t ReplayMode::view_pos = 0;
 
 bool ReplayMode::StartReplay(int skipturn) {
 	skip_turn = skipturn;
@@ -66,6 +70,8 @@ int ReplayMode::ReplayThread() {
 	set_script_reader((script_reader)DataManager::ScriptReaderEx);
 	set_card_reader((card_reader)DataManager::CardReader);
 	set_message_handler((message_handler)MessageHandler);
+	view.Clear();
+	view_pos = 0;
 	if(!StartDuel()) {
 		EndDuel();
 		return 0;
@@ -76,60 +82,33 @@ int ReplayMode::ReplayThread() {
 	mainGame->dInfo.isReplaySkiping = (skip_turn > 0);
 	char engineBuffer[0x1000];
 	is_continuing = true;
-	skip_step = 0;
-	if(mainGame->dInfo.isSingleMode) {
-		int len = get_message(pduel, (byte*)engineBuffer);
-		if (len > 0)
-			is_continuing = ReplayAnalyze(engineBuffer, len);
-	} else {
-		ReplayRefreshDeck(0);
-		ReplayRefreshDeck(1);
-		ReplayRefreshExtra(0);
-		ReplayRefreshExtra(1);
-	}
+	BeginPlayback();
 	exit_pending = false;
-	current_step = 0;
 	if(mainGame->dInfo.isReplaySkiping)
 		mainGame->gMutex.lock();
 	while (is_continuing && !exit_pending) {
-		int result = process(pduel);
-		int len = result & 0xffff;
-		/*int flag = result >> 16;*/
-		if (len > 0) {
-			get_message(pduel, (byte*)engineBuffer);
-			is_continuing = ReplayAnalyze(engineBuffer, len);
-			if(is_restarting) {
+		if(view_pos < view.records.size()) {
+			// back behind the engine after an undo
+			is_continuing = ViewAnalyze();
+		} else {
+			int result = process(pduel);
+			int len = result & 0xffff;
+			/*int flag = result >> 16;*/
+			if (len > 0) {
+				get_message(pduel, (byte*)engineBuffer);
+				is_continuing = ReplayAnalyze(engineBuffer, len);
+				// between buffers the engine and the field agree, keep undo a short catch-up
+				if(is_continuing && !is_restarting && (view.keyframes.empty() || current_step - view.keyframes.back().step >= VIEW_KEYFRAME_STEPS))
+					AddKeyframe();
+			}
+		}
+		if(is_restarting && is_continuing) {
+			if(!mainGame->dInfo.isReplaySkiping) {
 				mainGame->gMutex.lock();
-				is_restarting = false;
 				mainGame->dInfo.isReplaySkiping = true;
-				Restart(false);
-				int step = current_step - 1;
-				if(step < 0)
-					step = 0;
-				if(mainGame->dInfo.isSingleMode) {
-					is_continuing = true;
-					skip_step = 0;
-					int len = get_message(pduel, (byte*)engineBuffer);
-					if (len > 0) {
-						is_continuing = ReplayAnalyze(engineBuffer, len);
-					}
-				} else {
-					ReplayRefreshDeck(0);
-					ReplayRefreshDeck(1);
-					ReplayRefreshExtra(0);
-					ReplayRefreshExtra(1);
-				}
-				if(step == 0) {
-					Pause(true, false);
-					mainGame->dInfo.isStarted = true;
-					mainGame->dInfo.isFinished = false;
-					mainGame->dInfo.isReplaySkiping = false;
-					mainGame->dField.RefreshAllCards();
-					mainGame->gMutex.unlock();
-				}
-				skip_step = step;
-				current_step = 0;
 			}
+			is_restarting = false;
+			Seek(seek_step);
 		}
 	}
 	if(mainGame->dInfo.isReplaySkiping) {
@@ -252,43 +231,22 @@ void ReplayMode::EndDuel() {
 			mainGame->device->closeDevice();
 	}
 }
-void ReplayMode::Restart(bool refresh) {
-	end_duel(pduel);
-	mainGame->dInfo.isStarted = false;
-	mainGame->dInfo.isFinished = true;
-	mainGame->dField.Clear();
-	//mainGame->device->setEventReceiver(&mainGame->dField);
-	cur_replay.Rewind();
-	//mainGame->dInfo.isFirst = true;
-	mainGame->dInfo.tag_player[0] = false;
-	mainGame->dInfo.tag_player[1] = false;
-	if(!StartDuel()) {
-		EndDuel();
-	}
-	if(refresh) {
-		mainGame->dField.RefreshAllCards();
-		mainGame->dInfo.isStarted = true;
-		mainGame->dInfo.isFinished = false;
-		//mainGame->dInfo.isReplay = true;
-	}
-	skip_turn = 0;
-}
 void ReplayMode::Undo() {
 	if(skip_step > 0 || current_step == 0)
 		return;
+	seek_step = current_step - 1;
 	is_restarting = true;
 	Pause(false, false);
 }
 bool ReplayMode::ReplayAnalyze(char* msg, unsigned int len) {
 	char* pbuf = msg;
-	int player, count;
-	is_restarting = false;
 	while (pbuf - msg < (int)len) {
 		if(is_closing)
 			return false;
-		if(is_restarting) {
-			//is_restarting = false;
-			return true;
+		if(is_restarting && !mainGame->dInfo.isReplaySkiping) {
+			// the engine cannot go back, finish its buffer quietly and seek afterwards
+			mainGame->gMutex.lock();
+			mainGame->dInfo.isReplaySkiping = true;
 		}
 		if(is_swaping) {
 			mainGame->gMutex.lock();
@@ -297,8 +255,13 @@ bool ReplayMode::ReplayAnalyze(char* msg, unsigned int len) {
 			is_swaping = false;
 		}
 		char* offset = pbuf;
-		bool pauseable = true;
+		int msg_len = MessageDesc::Length(offset, len - (offset - msg));
+		if(msg_len < 0)
+			return false;
+		const MessageDesc* desc = MessageDesc::Get(offset[0]);
+		bool pauseable = !(desc->flags & MSG_FLAG_NO_PAUSE);
 		mainGame->dInfo.curMsg = BufferIO::ReadUInt8(pbuf);
+		pbuf = offset + msg_len;
 		switch (mainGame->dInfo.curMsg) {
 		case MSG_RETRY: {
 			if(mainGame->dInfo.isReplaySkiping) {
@@ -314,191 +277,33 @@ bool ReplayMode::ReplayAnalyze(char* msg, unsigned int len) {
 			mainGame->actionSignal.Wait();
 			return false;
 		}
-		case MSG_HINT: {
-			pbuf += 6;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
 		case MSG_WIN: {
 			if(mainGame->dInfo.isReplaySkiping) {
 				mainGame->dInfo.isReplaySkiping = false;
 				mainGame->dField.RefreshAllCards();
 				mainGame->gMutex.unlock();
 			}
-			pbuf += 2;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
+			ClientAnalyze(offset, msg_len);
 			return false;
 		}
-		case MSG_SELECT_BATTLECMD: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 11;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 8 + 2;
-			ReplayRefresh();
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_IDLECMD: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 11 + 3;
-			ReplayRefresh();
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_EFFECTYN: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 12;
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_YESNO: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 4;
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_OPTION: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_CARD:
-		case MSG_SELECT_TRIBUTE: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 3;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 8;
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_UNSELECT_CARD: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 4;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 8;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 8;
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_CHAIN: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += 10 + count * 13;
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_PLACE:
-		case MSG_SELECT_DISFIELD: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 5;
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_POSITION: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 5;
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_COUNTER: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 4;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 9;
-			return ReadReplayResponse();
-		}
-		case MSG_SELECT_SUM: {
-			pbuf++;
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 6;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 11;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 11;
-			return ReadReplayResponse();
-		}
-		case MSG_SORT_CARD: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			return ReadReplayResponse();
-		}
-		case MSG_CONFIRM_DECKTOP: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_CONFIRM_EXTRATOP: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_CONFIRM_CARDS: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
 		case MSG_SHUFFLE_DECK: {
-			player = BufferIO::ReadInt8(pbuf);
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefreshDeck(player);
-			break;
-		}
-		case MSG_SHUFFLE_HAND: {
-			/*int oplayer = */BufferIO::ReadInt8(pbuf);
-			int count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_SHUFFLE_EXTRA: {
-			/*int oplayer = */BufferIO::ReadInt8(pbuf);
-			int count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_REFRESH_DECK: {
-			pbuf++;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
+			ClientAnalyze(offset, msg_len);
+			ReplayRefreshDeck(offset[1]);
 			break;
 		}
 		case MSG_SWAP_GRAVE_DECK: {
-			player = BufferIO::ReadInt8(pbuf);
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefreshGrave(player);
+			ClientAnalyze(offset, msg_len);
+			ReplayRefreshGrave(offset[1]);
 			break;
 		}
 		case MSG_REVERSE_DECK: {
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
+			ClientAnalyze(offset, msg_len);
 			ReplayRefreshDeck(0);
 			ReplayRefreshDeck(1);
 			break;
 		}
-		case MSG_DECK_TOP: {
-			pbuf += 6;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_SHUFFLE_SET_CARD: {
-			pbuf++;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
 		case MSG_NEW_TURN: {
+			AddKeyframe();
 			if(skip_turn) {
 				skip_turn--;
 				if(skip_turn == 0) {
@@ -507,424 +312,295 @@ bool ReplayMode::ReplayAnalyze(char* msg, unsigned int len) {
 					mainGame->gMutex.unlock();
 				}
 			}
-			player = BufferIO::ReadInt8(pbuf);
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_NEW_PHASE: {
-			pbuf += 2;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefresh();
+			ClientAnalyze(offset, msg_len);
 			break;
 		}
 		case MSG_MOVE: {
-			int pc = pbuf[4];
-			int pl = pbuf[5];
-			/*int ps = pbuf[6];*/
-			/*int pp = pbuf[7];*/
-			int cc = pbuf[8];
-			int cl = pbuf[9];
-			int cs = pbuf[10];
-			/*int cp = pbuf[11];*/
-			pbuf += 16;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
+			int pc = offset[5];
+			int pl = offset[6];
+			/*int ps = offset[7];*/
+			/*int pp = offset[8];*/
+			int cc = offset[9];
+			int cl = offset[10];
+			int cs = offset[11];
+			/*int cp = offset[12];*/
+			ClientAnalyze(offset, msg_len);
 			if(cl && !(cl & 0x80) && (pl != cl || pc != cc))
 				ReplayRefreshSingle(cc, cl, cs);
 			break;
 		}
-		case MSG_POS_CHANGE: {
-			pbuf += 9;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_SET: {
-			pbuf += 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_SWAP: {
-			pbuf += 16;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_FIELD_DISABLED: {
-			pbuf += 4;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_SUMMONING: {
-			pbuf += 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_SUMMONED: {
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefresh();
-			break;
-		}
-		case MSG_SPSUMMONING: {
-			pbuf += 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_SPSUMMONED: {
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefresh();
-			break;
-		}
-		case MSG_FLIPSUMMONING: {
-			pbuf += 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_FLIPSUMMONED: {
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefresh();
-			break;
-		}
-		case MSG_CHAINING: {
-			pbuf += 16;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_CHAINED: {
-			pbuf++;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefresh();
-			break;
-		}
-		case MSG_CHAIN_SOLVING: {
-			pbuf++;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_CHAIN_SOLVED: {
-			pbuf++;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefresh();
-			pauseable = false;
-			break;
-		}
-		case MSG_CHAIN_END: {
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefresh();
-			pauseable = false;
-			break;
-		}
-		case MSG_CHAIN_NEGATED: {
-			pbuf++;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_CHAIN_DISABLED: {
-			pbuf++;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_CARD_SELECTED:
-		case MSG_RANDOM_SELECTED: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_BECOME_TARGET: {
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_DRAW: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_DAMAGE: {
-			pbuf += 5;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_RECOVER: {
-			pbuf += 5;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_EQUIP: {
-			pbuf += 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_LPUPDATE: {
-			pbuf += 5;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_UNEQUIP: {
-			pbuf += 4;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_CARD_TARGET: {
-			pbuf += 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_CANCEL_TARGET: {
-			pbuf += 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_PAY_LPCOST: {
-			pbuf += 5;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_ADD_COUNTER: {
-			pbuf += 7;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_REMOVE_COUNTER: {
-			pbuf += 7;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_ATTACK: {
-			pbuf += 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
-		}
-		case MSG_BATTLE: {
-			pbuf += 26;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
-			break;
-		}
-		case MSG_ATTACK_DISABLED: {
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			pauseable = false;
+		case MSG_TAG_SWAP: {
+			int player = offset[1];
+			ClientAnalyze(offset, msg_len);
+			ReplayRefreshDeck(player);
+			ReplayRefreshExtra(player);
 			break;
 		}
-		case MSG_DAMAGE_STEP_START: {
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefresh();
-			pauseable = false;
+		case MSG_RELOAD_FIELD: {
+			ClientAnalyze(offset, msg_len);
+			ReplayReload();
+			ReplayView::Write(view.records, VIEW_REFRESH_ALL, 0, 0, 0, 0);
+			mainGame->dField.RefreshAllCards();
 			break;
 		}
-		case MSG_DAMAGE_STEP_END: {
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefresh();
-			pauseable = false;
+		case MSG_WAITING:
+		case MSG_MATCH_KILL:
+		case MSG_AI_NAME:
+		case MSG_SHOW_HINT: {
 			break;
 		}
-		case MSG_MISSED_EFFECT: {
-			pbuf += 8;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
+		default: {
+			if(desc->flags & MSG_FLAG_RESPONSE) {
+				if(desc->refresh)
+					ReplayRefresh();
+				return ReadReplayResponse();
+			}
+			ClientAnalyze(offset, msg_len);
+			if(desc->refresh)
+				ReplayRefresh();
 			break;
 		}
-		case MSG_TOSS_COIN: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
 		}
-		case MSG_TOSS_DICE: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			break;
+		if(pauseable) {
+			ReplayView::Write(view.records, VIEW_STEP, 0, 0, 0, 0);
+			Step();
 		}
-		case MSG_ROCK_PAPER_SCISSORS: {
-			player = BufferIO::ReadInt8(pbuf);
-			return ReadReplayResponse();
+	}
+	return true;
+}
+bool ReplayMode::ViewAnalyze() {
+	while(view_pos < view.records.size()) {
+		if(is_closing)
+			return false;
+		if(is_restarting || exit_pending)
+			return true;
+		if(is_swaping) {
+			mainGame->gMutex.lock();
+			mainGame->dField.ReplaySwap();
+			mainGame->gMutex.unlock();
+			is_swaping = false;
 		}
-		case MSG_HAND_RES: {
-			pbuf += 1;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
+		unsigned char type;
+		const unsigned char* data;
+		int len;
+		if(!ReplayView::Read(view.records, view_pos, type, data, len))
 			break;
-		}
-		case MSG_ANNOUNCE_RACE: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 5;
-			return ReadReplayResponse();
-		}
-		case MSG_ANNOUNCE_ATTRIB: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 5;
-			return ReadReplayResponse();
-		}
-		case MSG_ANNOUNCE_CARD:
-		case MSG_ANNOUNCE_NUMBER: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadUInt8(pbuf);
-			pbuf += 4 * count;
-			return ReadReplayResponse();
-		}
-		case MSG_CARD_HINT: {
-			pbuf += 9;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
+		switch(type) {
+		case VIEW_MESSAGE: {
+			DuelClient::ClientAnalyze((char*)data, len);
 			break;
 		}
-		case MSG_PLAYER_HINT: {
-			pbuf += 6;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
+		case VIEW_STEP: {
+			Step();
 			break;
 		}
-		case MSG_MATCH_KILL: {
-			pbuf += 4;
+		case VIEW_FIELD: {
+			mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(data[0]), data[1], (char*)data + 2);
 			break;
 		}
-		case MSG_TAG_SWAP: {
-			player = pbuf[0];
-			pbuf += pbuf[2] * 4 + pbuf[4] * 4 + 9;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayRefreshDeck(player);
-			ReplayRefreshExtra(player);
+		case VIEW_CARD: {
+			mainGame->dField.UpdateCard(mainGame->LocalPlayer(data[0]), data[1], data[2], (char*)data + 3);
 			break;
 		}
-		case MSG_RELOAD_FIELD: {
-			pbuf++;
-			for(int p = 0; p < 2; ++p) {
-				pbuf += 4;
-				for(int seq = 0; seq < 7; ++seq) {
-					int val = BufferIO::ReadInt8(pbuf);
-					if(val)
-						pbuf += 2;
-				}
-				for(int seq = 0; seq < 8; ++seq) {
-					int val = BufferIO::ReadInt8(pbuf);
-					if(val)
-						pbuf++;
-				}
-				pbuf += 6;
-			}
-			pbuf++;
-			DuelClient::ClientAnalyze(offset, pbuf - offset);
-			ReplayReload();
+		case VIEW_REFRESH_ALL: {
 			mainGame->dField.RefreshAllCards();
 			break;
 		}
-		case MSG_AI_NAME: {
-			int len = BufferIO::ReadInt16(pbuf);
-			pbuf += len + 1;
-			break;
 		}
-		case MSG_SHOW_HINT: {
-			int len = BufferIO::ReadInt16(pbuf);
-			pbuf += len + 1;
-			break;
-		}
-		}
-		if(pauseable) {
-			current_step++;
-			if(skip_step) {
-				skip_step--;
-				if(skip_step == 0) {
-					Pause(true, false);
-					mainGame->dInfo.isStarted = true;
-					mainGame->dInfo.isFinished = false;
-					mainGame->dInfo.isReplaySkiping = false;
-					mainGame->dField.RefreshAllCards();
-					mainGame->gMutex.unlock();
-				}
-			}
-			if(is_pausing) {
-				is_paused = true;
-				mainGame->actionSignal.Reset();
-				mainGame->actionSignal.Wait();
-				is_paused = false;
-			}
+	}
+	return true;
+}
+void ReplayMode::Step() {
+	current_step++;
+	if(skip_step) {
+		skip_step--;
+		if(skip_step == 0) {
+			Pause(true, false);
+			mainGame->dInfo.isStarted = true;
+			mainGame->dInfo.isFinished = false;
+			mainGame->dInfo.isReplaySkiping = false;
+			mainGame->dField.RefreshAllCards();
+			mainGame->gMutex.unlock();
 		}
 	}
+	if(is_pausing && !is_restarting) {
+		is_paused = true;
+		mainGame->actionSignal.Reset();
+		mainGame->actionSignal.Wait();
+		is_paused = false;
+	}
+}
+// Rebuilds the field as it was after the given step from the nearest keyframe.
+// Called with gMutex held and isReplaySkiping set.
+void ReplayMode::Seek(int step) {
+	const ViewKeyframe* keyframe = view.FindKeyframe(step);
+	if(!keyframe) {
+		// nothing recorded to reload, run the duel again from its first message
+		if(!Restart()) {
+			is_continuing = false;
+			return;
+		}
+		keyframe = view.FindKeyframe(step);
+	}
+	mainGame->gMutex.unlock();
+	DuelClient::ClientAnalyze((char*)keyframe->reload.data(), keyframe->reload.size());
+	mainGame->gMutex.lock();
+	size_t pos = 0;
+	unsigned char type;
+	const unsigned char* data;
+	int len;
+	while(ReplayView::Read(keyframe->field, pos, type, data, len))
+		mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(data[0]), data[1], (char*)data + 2);
+	mainGame->dInfo.turn = keyframe->turn;
+	mainGame->dInfo.tag_player[0] = keyframe->tag_player[0];
+	mainGame->dInfo.tag_player[1] = keyframe->tag_player[1];
+	view_pos = keyframe->offset;
+	current_step = keyframe->step;
+	skip_step = step > keyframe->step ? step - keyframe->step : 0;
+	if(skip_step == 0) {
+		Pause(true, false);
+		mainGame->dInfo.isStarted = true;
+		mainGame->dInfo.isFinished = false;
+		mainGame->dInfo.isReplaySkiping = false;
+		mainGame->dField.RefreshAllCards();
+		mainGame->gMutex.unlock();
+	}
+}
+// the first messages of a duel, up to the keyframe at step 0
+void ReplayMode::BeginPlayback() {
+	skip_step = 0;
+	if(mainGame->dInfo.isSingleMode) {
+		char engineBuffer[0x1000];
+		int len = get_message(pduel, (byte*)engineBuffer);
+		if (len > 0)
+			is_continuing = ReplayAnalyze(engineBuffer, len);
+	} else {
+		ReplayRefreshDeck(0);
+		ReplayRefreshDeck(1);
+		ReplayRefreshExtra(0);
+		ReplayRefreshExtra(1);
+	}
+	current_step = 0;
+	AddKeyframe();
+}
+bool ReplayMode::Restart() {
+	end_duel(pduel);
+	mainGame->dField.Clear();
+	cur_replay.Rewind();
+	mainGame->dInfo.tag_player[0] = false;
+	mainGame->dInfo.tag_player[1] = false;
+	view.Clear();
+	view_pos = 0;
+	if(!StartDuel())
+		return false;
+	BeginPlayback();
 	return true;
 }
+void ReplayMode::AddKeyframe() {
+	unsigned char queryBuffer[0x4000];
+	static const int locations[] = { LOCATION_MZONE, LOCATION_SZONE, LOCATION_HAND, LOCATION_DECK, LOCATION_EXTRA, LOCATION_GRAVE, LOCATION_REMOVED };
+	view.keyframes.push_back(ViewKeyframe());
+	ViewKeyframe& keyframe = view.keyframes.back();
+	keyframe.offset = view.records.size();
+	keyframe.step = current_step;
+	keyframe.turn = mainGame->dInfo.turn;
+	keyframe.tag_player[0] = mainGame->dInfo.tag_player[0];
+	keyframe.tag_player[1] = mainGame->dInfo.tag_player[1];
+	int len = query_field_info(pduel, queryBuffer);
+	keyframe.reload.assign(queryBuffer, queryBuffer + len);
+	for(int p = 0; p < 2; ++p) {
+		for(auto loc : locations) {
+			unsigned char head[2] = { (unsigned char)p, (unsigned char)loc };
+			len = query_field_card(pduel, p, loc, 0xffdfff, queryBuffer, 0);
+			ReplayView::Write(keyframe.field, VIEW_FIELD, head, 2, queryBuffer, len);
+		}
+	}
+}
+void ReplayMode::ClientAnalyze(char* msg, unsigned int len) {
+	ReplayView::Write(view.records, VIEW_MESSAGE, 0, 0, (unsigned char*)msg, len);
+	DuelClient::ClientAnalyze(msg, len);
+}
+void ReplayMode::UpdateFieldCard(int player, int location, unsigned char* data, int len) {
+	unsigned char head[2] = { (unsigned char)player, (unsigned char)location };
+	ReplayView::Write(view.records, VIEW_FIELD, head, 2, data, len);
+	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(player), location, (char*)data);
+}
+void ReplayMode::UpdateCard(int player, int location, int sequence, unsigned char* data, int len) {
+	unsigned char head[3] = { (unsigned char)player, (unsigned char)location, (unsigned char)sequence };
+	ReplayView::Write(view.records, VIEW_CARD, head, 3, data, len);
+	mainGame->dField.UpdateCard(mainGame->LocalPlayer(player), location, sequence, (char*)data);
+}
 void ReplayMode::ReplayRefresh(int flag) {
 	unsigned char queryBuffer[0x4000];
-	/*int len = */query_field_card(pduel, 0, LOCATION_MZONE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_MZONE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_MZONE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_MZONE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 0, LOCATION_SZONE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_SZONE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_SZONE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_SZONE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 0, LOCATION_HAND, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_HAND, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_HAND, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_HAND, (char*)queryBuffer);
+	int len = query_field_card(pduel, 0, LOCATION_MZONE, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_MZONE, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_MZONE, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_MZONE, queryBuffer, len);
+	len = query_field_card(pduel, 0, LOCATION_SZONE, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_SZONE, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_SZONE, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_SZONE, queryBuffer, len);
+	len = query_field_card(pduel, 0, LOCATION_HAND, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_HAND, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_HAND, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_HAND, queryBuffer, len);
 }
 void ReplayMode::ReplayRefreshHand(int player, int flag) {
 	unsigned char queryBuffer[0x2000];
-	/*int len = */query_field_card(pduel, player, LOCATION_HAND, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(player), LOCATION_HAND, (char*)queryBuffer);
+	int len = query_field_card(pduel, player, LOCATION_HAND, flag, queryBuffer, 0);
+	UpdateFieldCard(player, LOCATION_HAND, queryBuffer, len);
 }
 void ReplayMode::ReplayRefreshGrave(int player, int flag) {
 	unsigned char queryBuffer[0x2000];
-	/*int len = */query_field_card(pduel, player, LOCATION_GRAVE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(player), LOCATION_GRAVE, (char*)queryBuffer);
+	int len = query_field_card(pduel, player, LOCATION_GRAVE, flag, queryBuffer, 0);
+	UpdateFieldCard(player, LOCATION_GRAVE, queryBuffer, len);
 }
 void ReplayMode::ReplayRefreshDeck(int player, int flag) {
 	unsigned char queryBuffer[0x2000];
-	/*int len = */query_field_card(pduel, player, LOCATION_DECK, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(player), LOCATION_DECK, (char*)queryBuffer);
+	int len = query_field_card(pduel, player, LOCATION_DECK, flag, queryBuffer, 0);
+	UpdateFieldCard(player, LOCATION_DECK, queryBuffer, len);
 }
 void ReplayMode::ReplayRefreshExtra(int player, int flag) {
 	unsigned char queryBuffer[0x2000];
-	/*int len = */query_field_card(pduel, player, LOCATION_EXTRA, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(player), LOCATION_EXTRA, (char*)queryBuffer);
+	int len = query_field_card(pduel, player, LOCATION_EXTRA, flag, queryBuffer, 0);
+	UpdateFieldCard(player, LOCATION_EXTRA, queryBuffer, len);
 }
 void ReplayMode::ReplayRefreshSingle(int player, int location, int sequence, int flag) {
 	unsigned char queryBuffer[0x4000];
-	/*int len = */query_card(pduel, player, location, sequence, flag, queryBuffer, 0);
-	mainGame->dField.UpdateCard(mainGame->LocalPlayer(player), location, sequence, (char*)queryBuffer);
+	int len = query_card(pduel, player, location, sequence, flag, queryBuffer, 0);
+	UpdateCard(player, location, sequence, queryBuffer, len);
 }
 void ReplayMode::ReplayReload() {
 	unsigned char queryBuffer[0x4000];
 	unsigned int flag = 0xffdfff;
-	/*int len = */query_field_card(pduel, 0, LOCATION_MZONE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_MZONE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_MZONE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_MZONE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 0, LOCATION_SZONE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_SZONE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_SZONE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_SZONE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 0, LOCATION_HAND, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_HAND, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_HAND, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_HAND, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 0, LOCATION_DECK, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_DECK, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_DECK, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_DECK, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 0, LOCATION_EXTRA, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_EXTRA, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_EXTRA, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_EXTRA, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 0, LOCATION_GRAVE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_GRAVE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_GRAVE, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_GRAVE, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 0, LOCATION_REMOVED, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(0), LOCATION_REMOVED, (char*)queryBuffer);
-	/*len = */query_field_card(pduel, 1, LOCATION_REMOVED, flag, queryBuffer, 0);
-	mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(1), LOCATION_REMOVED, (char*)queryBuffer);
+	int len = query_field_card(pduel, 0, LOCATION_MZONE, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_MZONE, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_MZONE, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_MZONE, queryBuffer, len);
+	len = query_field_card(pduel, 0, LOCATION_SZONE, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_SZONE, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_SZONE, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_SZONE, queryBuffer, len);
+	len = query_field_card(pduel, 0, LOCATION_HAND, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_HAND, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_HAND, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_HAND, queryBuffer, len);
+	len = query_field_card(pduel, 0, LOCATION_DECK, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_DECK, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_DECK, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_DECK, queryBuffer, len);
+	len = query_field_card(pduel, 0, LOCATION_EXTRA, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_EXTRA, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_EXTRA, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_EXTRA, queryBuffer, len);
+	len = query_field_card(pduel, 0, LOCATION_GRAVE, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_GRAVE, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_GRAVE, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_GRAVE, queryBuffer, len);
+	len = query_field_card(pduel, 0, LOCATION_REMOVED, flag, queryBuffer, 0);
+	UpdateFieldCard(0, LOCATION_REMOVED, queryBuffer, len);
+	len = query_field_card(pduel, 1, LOCATION_REMOVED, flag, queryBuffer, 0);
+	UpdateFieldCard(1, LOCATION_REMOVED, queryBuffer, len);
 }
 int ReplayMode::MessageHandler(long fduel, int type) {
 	if(!enable_log)
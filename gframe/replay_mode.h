@@ -5,6 +5,7 @@
 #include "data_manager.h"
 #include "deck_manager.h"
 #include "replay.h"
+#include "replay_view.h"
 #include "../ocgcore/mtrandom.h"
 
 namespace ygo {
@@ -22,6 +23,9 @@ private:
 	static int skip_turn;
 	static int current_step;
 	static int skip_step;
+	static int seek_step;
+	static ReplayView view;
+	static size_t view_pos;
 
 public:
 	static Replay cur_replay;
@@ -35,9 +39,17 @@ public:
 	static int ReplayThread();
 	static bool StartDuel();
 	static void EndDuel();
-	static void Restart(bool refresh);
 	static void Undo();
 	static bool ReplayAnalyze(char* msg, unsigned int len);
+	static bool ViewAnalyze();
+	static void Step();
+	static void Seek(int step);
+	static void BeginPlayback();
+	static bool Restart();
+	static void AddKeyframe();
+	static void ClientAnalyze(char* msg, unsigned int len);
+	static void UpdateFieldCard(int player, int location, unsigned char* data, int len);
+	static void UpdateCard(int player, int location, int sequence, unsigned char* data, int len);
 	
 	static void ReplayRefresh(int flag = 0xf81fff);
 	static void ReplayRefreshHand(int player, int flag = 0x781fff);
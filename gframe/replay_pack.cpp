@@ -0,0 +1,203 @@
+#include "replay_pack.h"
+#include "lzma/LzmaLib.h"
+#include <algorithm>
+
+namespace ygo {
+
+#define PACK_ID			0x6b707279
+#define PACK_VERSION	1
+
+struct PackHeader {
+	unsigned int id;
+	unsigned int version;
+	unsigned int count;
+	unsigned int block_count;
+	unsigned long long index_offset;
+};
+
+ReplayPack::ReplayPack() {
+	fp = 0;
+	count = 0;
+	index_offset = 0;
+	current_block = -1;
+	write_offset = 0;
+}
+ReplayPack::~ReplayPack() {
+	Close();
+}
+bool ReplayPack::Open(FILE* file) {
+	Close();
+	fp = file;
+	if(!fp)
+		return false;
+	PackHeader pheader;
+	if(fread(&pheader, sizeof(pheader), 1, fp) != 1 || pheader.id != PACK_ID || pheader.version != PACK_VERSION) {
+		Close();
+		return false;
+	}
+	// the tables must fit in the file before anything is sized from them
+	unsigned long long file_size;
+	if(!GetSize(file_size) || pheader.index_offset < sizeof(pheader) || pheader.index_offset > file_size
+	        || (file_size - pheader.index_offset) / sizeof(PackBlock) < pheader.block_count
+	        || (file_size - pheader.index_offset - pheader.block_count * sizeof(PackBlock)) / sizeof(PackEntry) < pheader.count) {
+		Close();
+		return false;
+	}
+	count = pheader.count;
+	index_offset = pheader.index_offset;
+	blocks.resize(pheader.block_count);
+	if(!Seek(index_offset) || (!blocks.empty() && fread(blocks.data(), sizeof(PackBlock), blocks.size(), fp) != blocks.size())) {
+		Close();
+		return false;
+	}
+	for(auto bit = blocks.begin(); bit != blocks.end(); ++bit) {
+		if(bit->offset < sizeof(pheader) || bit->offset > index_offset || index_offset - bit->offset < bit->comp_size
+		        || bit->size > PACK_BLOCK_SIZE + REPLAY_MAX_SIZE) {
+			Close();
+			return false;
+		}
+	}
+	return true;
+}
+bool ReplayPack::Create(FILE* file) {
+	Close();
+	fp = file;
+	if(!fp)
+		return false;
+	PackHeader pheader = {};
+	write_offset = sizeof(pheader);
+	return fwrite(&pheader, sizeof(pheader), 1, fp) == 1;
+}
+void ReplayPack::Close() {
+	if(fp)
+		fclose(fp);
+	fp = 0;
+	count = 0;
+	index_offset = 0;
+	blocks.clear();
+	entries.clear();
+	block_data.clear();
+	current_block = -1;
+	write_offset = 0;
+}
+bool ReplayPack::ReadEntries(std::vector<PackEntry>& list) {
+	list.resize(count);
+	if(!count)
+		return true;
+	return Seek(index_offset + blocks.size() * sizeof(PackBlock)) && fread(list.data(), sizeof(PackEntry), count, fp) == count;
+}
+bool ReplayPack::ReadEntry(unsigned int id, PackEntry& entry) {
+	if(id >= count)
+		return false;
+	return Seek(index_offset + blocks.size() * sizeof(PackBlock) + id * sizeof(PackEntry)) && fread(&entry, sizeof(entry), 1, fp) == 1;
+}
+bool ReplayPack::Read(unsigned int id, ReplayHeader& header, std::vector<unsigned char>& data) {
+	PackEntry entry;
+	if(!ReadEntry(id, entry) || !LoadBlock(entry.block))
+		return false;
+	if(entry.offset > block_data.size() || block_data.size() - entry.offset < entry.header.datasize)
+		return false;
+	header = entry.header;
+	data.assign(block_data.begin() + entry.offset, block_data.begin() + entry.offset + entry.header.datasize);
+	return true;
+}
+bool ReplayPack::Add(const Replay& replay) {
+	if(!block_data.empty() && block_data.size() + replay.replay_size > PACK_BLOCK_SIZE && !WriteBlock())
+		return false;
+	PackEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.block = (unsigned int)blocks.size();
+	entry.offset = (unsigned int)block_data.size();
+	entry.header = replay.pheader;
+	entry.header.flag &= ~REPLAY_COMPRESSED;
+	entry.header.datasize = (unsigned int)replay.replay_size;
+	// the player names open the stream
+	size_t name_size = std::min((entry.header.flag & REPLAY_TAG) ? sizeof(entry.players) : sizeof(entry.players) / 2, replay.replay_size);
+	memcpy(entry.players, replay.replay_data.data(), name_size);
+	for(int p = 0; p < 4; ++p)
+		entry.players[p][19] = 0;
+	entries.push_back(entry);
+	block_data.insert(block_data.end(), replay.replay_data.begin(), replay.replay_data.begin() + replay.replay_size);
+	return true;
+}
+bool ReplayPack::Finish() {
+	if(!block_data.empty() && !WriteBlock())
+		return false;
+	PackHeader pheader;
+	pheader.id = PACK_ID;
+	pheader.version = PACK_VERSION;
+	pheader.count = (unsigned int)entries.size();
+	pheader.block_count = (unsigned int)blocks.size();
+	pheader.index_offset = write_offset;
+	if(!blocks.empty() && fwrite(blocks.data(), sizeof(PackBlock), blocks.size(), fp) != blocks.size())
+		return false;
+	if(!entries.empty() && fwrite(entries.data(), sizeof(PackEntry), entries.size(), fp) != entries.size())
+		return false;
+	if(!Seek(0) || fwrite(&pheader, sizeof(pheader), 1, fp) != 1)
+		return false;
+	bool ok = fflush(fp) == 0;
+	Close();
+	return ok;
+}
+bool ReplayPack::Seek(unsigned long long offset) {
+#ifdef _WIN32
+	return _fseeki64(fp, offset, SEEK_SET) == 0;
+#else
+	return fseeko(fp, offset, SEEK_SET) == 0;
+#endif
+}
+bool ReplayPack::GetSize(unsigned long long& size) {
+#ifdef _WIN32
+	if(_fseeki64(fp, 0, SEEK_END) != 0)
+		return false;
+	long long pos = _ftelli64(fp);
+#else
+	if(fseeko(fp, 0, SEEK_END) != 0)
+		return false;
+	long long pos = ftello(fp);
+#endif
+	if(pos < 0)
+		return false;
+	size = pos;
+	return true;
+}
+bool ReplayPack::LoadBlock(unsigned int block) {
+	if((int)block == current_block)
+		return true;
+	current_block = -1;
+	if(block >= blocks.size())
+		return false;
+	const PackBlock& pblock = blocks[block];
+	std::vector<unsigned char> comp_data(pblock.comp_size);
+	if(!Seek(pblock.offset) || (pblock.comp_size && fread(comp_data.data(), pblock.comp_size, 1, fp) != 1))
+		return false;
+	block_data.resize(pblock.size);
+	size_t size = pblock.size;
+	size_t comp_size = pblock.comp_size;
+	if(LzmaUncompress(block_data.data(), &size, comp_data.data(), &comp_size, pblock.props, 5) != SZ_OK || size != pblock.size)
+		return false;
+	current_block = block;
+	return true;
+}
+bool ReplayPack::WriteBlock() {
+	PackBlock pblock;
+	memset(&pblock, 0, sizeof(pblock));
+	pblock.offset = write_offset;
+	pblock.size = (unsigned int)block_data.size();
+	std::vector<unsigned char> comp_data(block_data.size() + block_data.size() / 3 + 128);
+	size_t comp_size = comp_data.size();
+	size_t props_size = 5;
+	// level 9 with the whole block in the dictionary
+	if(LzmaCompress(comp_data.data(), &comp_size, block_data.data(), block_data.size(), pblock.props, &props_size,
+	                9, PACK_BLOCK_SIZE * 2, 3, 0, 2, 64, 1) != SZ_OK)
+		return false;
+	pblock.comp_size = (unsigned int)comp_size;
+	if(fwrite(comp_data.data(), comp_size, 1, fp) != 1)
+		return false;
+	write_offset += comp_size;
+	blocks.push_back(pblock);
+	block_data.clear();
+	return true;
+}
+
+}
@@ -0,0 +1,64 @@
+#ifndef REPLAY_PACK_H
+#define REPLAY_PACK_H
+
+#include "config.h"
+#include "replay.h"
+#include <vector>
+
+namespace ygo {
+
+// replays are put together until a block holds this many bytes
+#define PACK_BLOCK_SIZE		0x100000
+
+struct PackBlock {
+	unsigned long long offset;
+	unsigned int comp_size;
+	unsigned int size;
+	unsigned char props[8];
+};
+
+struct PackEntry {
+	unsigned int block;
+	unsigned int offset;
+	ReplayHeader header;	// uncompressed, datasize bytes at offset in the block
+	unsigned short players[4][20];
+};
+
+// Many replays in one file. The replay streams are stored uncompressed one
+// after another and compressed in blocks of about PACK_BLOCK_SIZE, so the deck
+// lists and names they have in common are compressed once per block rather than
+// once per replay. The block table and the entries are kept at the end, and an
+// entry is found by its id, which is its position in the pack.
+class ReplayPack {
+public:
+	ReplayPack();
+	~ReplayPack();
+	bool Open(FILE* file);
+	bool Create(FILE* file);
+	void Close();
+	unsigned int GetCount() const { return count; }
+	bool ReadEntries(std::vector<PackEntry>& list);
+	bool ReadEntry(unsigned int id, PackEntry& entry);
+	bool Read(unsigned int id, ReplayHeader& header, std::vector<unsigned char>& data);
+	bool Add(const Replay& replay);
+	bool Finish();
+
+private:
+	bool Seek(unsigned long long offset);
+	bool GetSize(unsigned long long& size);
+	bool LoadBlock(unsigned int block);
+	bool WriteBlock();
+
+	FILE* fp;
+	unsigned int count;
+	unsigned long long index_offset;
+	std::vector<PackBlock> blocks;
+	std::vector<PackEntry> entries;
+	std::vector<unsigned char> block_data;
+	int current_block;
+	unsigned long long write_offset;
+};
+
+}
+
+#endif //REPLAY_PACK_H
@@ -0,0 +1,284 @@
+#include "replay_runner.h"
+#include "data_manager.h"
+#include "msg_desc.h"
+#include "../ocgcore/ocgapi.h"
+#include "../ocgcore/common.h"
+#include "../ocgcore/mtrandom.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace ygo {
+
+std::mutex ReplayRunner::engine_mutex;
+thread_local std::string ReplayRunner::script_root;
+
+// FNV-1a
+static unsigned int Fingerprint(const char* data, size_t length) {
+	unsigned int hash = 2166136261u;
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+// adds the cards of one deck section, false if the replay is too short to hold them
+static bool LoadCards(Replay& replay, long pduel, int player, int location, bool tag) {
+	int count = replay.ReadInt32();
+	size_t left = replay.replay_data.data() + replay.replay_size - replay.pdata;
+	if(replay.read_error || count < 0 || (size_t)count > left / 4) {
+		replay.read_error = true;
+		return false;
+	}
+	for(int i = 0; i < count; ++i) {
+		if(tag)
+			new_tag_card(pduel, replay.ReadInt32(), player, location);
+		else
+			new_card(pduel, replay.ReadInt32(), player, player, location, 0, POS_FACEDOWN_DEFENSE);
+	}
+	return true;
+}
+
+void ReplayRunner::Init() {
+	set_script_reader((script_reader)ScriptReader);
+	set_card_reader((card_reader)DataManager::CardReader);
+	set_message_handler((message_handler)MessageHandler);
+}
+void ReplayRunner::Run(const std::string& file, ReplayResult& result, std::vector<ReplayStep>* trace) {
+	auto start = std::chrono::steady_clock::now();
+	result.file = file;
+	result.status = "unfinished";
+	result.failed = false;
+	result.winner = -1;
+	result.reason = -1;
+	result.turns = 0;
+	result.steps = 0;
+	result.wall_ms = 0;
+	result.diverge_step = -1;
+	result.diverge_turn = 0;
+	result.last_msg = -1;
+	result.reference_msg = -1;
+	result.candidate_msg = -1;
+	Replay replay;
+	wchar_t wname[256];
+	BufferIO::DecodeUTF8(file.c_str(), wname);
+	if(!replay.OpenReplay(wname)) {
+		result.status = "cannot open";
+		result.failed = true;
+		return;
+	}
+	long pduel = 0;
+	if(!StartDuel(replay, pduel)) {
+		result.status = replay.read_error ? "bad replay" : "cannot start";
+		result.failed = true;
+	} else {
+		char engineBuffer[0x1000];
+		bool finished = false;
+		if(replay.pheader.flag & REPLAY_SINGLE_MODE) {
+			int len = get_message(pduel, (byte*)engineBuffer);
+			if(len > 0)
+				finished = Analyze(replay, pduel, engineBuffer, len, result, trace);
+		}
+		unsigned int engFlag = 0;
+		while(!finished && engFlag != 2) {
+			int ret = process(pduel);
+			unsigned int engLen = ret & 0xffff;
+			engFlag = ret >> 16;
+			result.steps++;
+			if(engLen > 0) {
+				get_message(pduel, (byte*)engineBuffer);
+				finished = Analyze(replay, pduel, engineBuffer, engLen, result, trace);
+			}
+		}
+	}
+	if(pduel) {
+		engine_mutex.lock();
+		end_duel(pduel);
+		engine_mutex.unlock();
+	}
+	result.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+void ReplayRunner::Compare(const std::string& file, const std::string& candidate, ReplayResult& result) {
+	std::vector<ReplayStep> reference_trace;
+	std::vector<ReplayStep> candidate_trace;
+	ReplayResult candidate_result;
+	Run(file, result, &reference_trace);
+	script_root = candidate;
+	Run(file, candidate_result, &candidate_trace);
+	script_root.clear();
+	result.wall_ms += candidate_result.wall_ms;
+	if(result.failed)
+		return;
+	size_t i = 0;
+	while(i < reference_trace.size() && i < candidate_trace.size()
+	        && reference_trace[i].msg == candidate_trace[i].msg && reference_trace[i].hash == candidate_trace[i].hash)
+		++i;
+	if(i == reference_trace.size() && i == candidate_trace.size())
+		return;
+	result.status = "diverged";
+	result.failed = true;
+	result.diverge_step = (int)i;
+	if(i > 0)
+		result.last_msg = reference_trace[i - 1].msg;
+	if(i < reference_trace.size()) {
+		result.diverge_turn = reference_trace[i].turn;
+		result.reference_msg = reference_trace[i].msg;
+	}
+	if(i < candidate_trace.size()) {
+		result.diverge_turn = candidate_trace[i].turn;
+		result.candidate_msg = candidate_trace[i].msg;
+	}
+}
+void ReplayRunner::RunAll(const std::vector<std::string>& files, int threads, const char* candidate, const std::function<void(const ReplayResult&)>& done) {
+	std::atomic<size_t> next(0);
+	std::mutex done_mutex;
+	auto worker = [&]() {
+		size_t i;
+		while((i = next.fetch_add(1)) < files.size()) {
+			ReplayResult result;
+			if(candidate)
+				Compare(files[i], candidate, result);
+			else
+				Run(files[i], result);
+			std::lock_guard<std::mutex> lock(done_mutex);
+			done(result);
+		}
+	};
+	if(threads < 1)
+		threads = 1;
+	if((size_t)threads > files.size())
+		threads = (int)files.size();
+	std::vector<std::thread> pool;
+	for(int i = 1; i < threads; ++i)
+		pool.push_back(std::thread(worker));
+	worker();
+	for(auto tit = pool.begin(); tit != pool.end(); ++tit)
+		tit->join();
+}
+bool ReplayRunner::StartDuel(Replay& replay, long& pduel) {
+	const ReplayHeader& rh = replay.pheader;
+	mtrandom rnd;
+	rnd.reset(rh.seed);
+	wchar_t name[20];
+	replay.ReadName(name);
+	replay.ReadName(name);
+	if(rh.flag & REPLAY_TAG) {
+		replay.ReadName(name);
+		replay.ReadName(name);
+	}
+	engine_mutex.lock();
+	pduel = create_duel(rnd.rand());
+	engine_mutex.unlock();
+	int start_lp = replay.ReadInt32();
+	int start_hand = replay.ReadInt32();
+	int draw_count = replay.ReadInt32();
+	int opt = replay.ReadInt32();
+	if(replay.read_error)
+		return false;
+	set_player_info(pduel, 0, start_lp, start_hand, draw_count);
+	set_player_info(pduel, 1, start_lp, start_hand, draw_count);
+	if(!(rh.flag & REPLAY_SINGLE_MODE)) {
+		bool tag = (opt & DUEL_TAG_MODE) != 0;
+		if(!LoadCards(replay, pduel, 0, LOCATION_DECK, false) || !LoadCards(replay, pduel, 0, LOCATION_EXTRA, false))
+			return false;
+		if(tag && (!LoadCards(replay, pduel, 0, LOCATION_DECK, true) || !LoadCards(replay, pduel, 0, LOCATION_EXTRA, true)))
+			return false;
+		if(!LoadCards(replay, pduel, 1, LOCATION_DECK, false) || !LoadCards(replay, pduel, 1, LOCATION_EXTRA, false))
+			return false;
+		if(tag && (!LoadCards(replay, pduel, 1, LOCATION_DECK, true) || !LoadCards(replay, pduel, 1, LOCATION_EXTRA, true)))
+			return false;
+	} else {
+		char filename[256];
+		size_t slen = (unsigned short)replay.ReadInt16();
+		if(slen >= sizeof(filename))
+			replay.read_error = true;
+		else
+			replay.ReadData(filename, slen);
+		if(replay.read_error)
+			return false;
+		filename[slen] = 0;
+		if(!preload_script(pduel, filename, 0))
+			return false;
+	}
+	start_duel(pduel, opt);
+	return true;
+}
+// returns true once the duel is over or the replay has no more responses
+bool ReplayRunner::Analyze(Replay& replay, long pduel, char* msg, unsigned int len, ReplayResult& result, std::vector<ReplayStep>* trace) {
+	char* pbuf = msg;
+	while(pbuf - msg < (int)len) {
+		char* offset = pbuf;
+		int msg_len = MessageDesc::Length(offset, len - (offset - msg));
+		if(msg_len < 0) {
+			result.status = "bad message";
+			result.failed = true;
+			return true;
+		}
+		unsigned char type = BufferIO::ReadUInt8(pbuf);
+		pbuf = offset + msg_len;
+		if(type == MSG_NEW_TURN)
+			result.turns++;
+		if(trace) {
+			ReplayStep step;
+			step.msg = type;
+			step.turn = result.turns;
+			step.hash = Fingerprint(offset, msg_len);
+			trace->push_back(step);
+		}
+		switch(type) {
+		case MSG_RETRY: {
+			result.status = "retry";
+			result.failed = true;
+			return true;
+		}
+		case MSG_WIN: {
+			pbuf = offset + 1;
+			result.winner = BufferIO::ReadUInt8(pbuf);
+			result.reason = BufferIO::ReadUInt8(pbuf);
+			result.status = "win";
+			return true;
+		}
+		default: {
+			const MessageDesc* desc = MessageDesc::Get(type);
+			if(desc->flags & MSG_FLAG_RESPONSE) {
+				unsigned char resp[64];
+				if(!replay.ReadNextResponse(resp))
+					return true;
+				set_responseb(pduel, resp);
+				return false;
+			}
+			break;
+		}
+		}
+	}
+	return false;
+}
+// same lookup as DataManager::ScriptReaderEx, below script_root when it is set
+byte* ReplayRunner::ScriptReader(const char* script_name, int* slen) {
+	if(script_root.empty() || script_name[0] == '/')
+		return DataManager::ScriptReaderEx(script_name, slen);
+	char first[1024];
+	char second[1024];
+	if(prefer_expansion_script) {
+		snprintf(first, sizeof(first), "%s/expansions/%s", script_root.c_str(), script_name + 2);
+		snprintf(second, sizeof(second), "%s/%s", script_root.c_str(), script_name + 2);
+	} else {
+		snprintf(first, sizeof(first), "%s/%s", script_root.c_str(), script_name + 2);
+		snprintf(second, sizeof(second), "%s/expansions/%s", script_root.c_str(), script_name + 2);
+	}
+	byte* buffer = DataManager::ScriptReader(first, slen);
+	if(buffer)
+		return buffer;
+	return DataManager::ScriptReader(second, slen);
+}
+int ReplayRunner::MessageHandler(long fduel, int type) {
+	if(!enable_log)
+		return 0;
+	char msgbuf[1024];
+	get_log_message(fduel, (byte*)msgbuf);
+	fprintf(stderr, "%s\n", msgbuf);
+	return 0;
+}
+
+}
@@ -0,0 +1,62 @@
+#ifndef REPLAY_RUNNER_H
+#define REPLAY_RUNNER_H
+
+#include "config.h"
+#include "replay.h"
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ygo {
+
+// fingerprint of one engine message
+struct ReplayStep {
+	unsigned char msg;
+	int turn;
+	unsigned int hash;
+};
+
+struct ReplayResult {
+	std::string file;
+	const char* status;
+	bool failed;
+	int winner;
+	int reason;
+	int turns;
+	int steps;
+	double wall_ms;
+	// first message where the candidate scripts differ, -1 if none
+	int diverge_step;
+	int diverge_turn;
+	int last_msg;
+	int reference_msg;
+	int candidate_msg;
+};
+
+// Drives ocgcore through recorded replays without a client attached.
+class ReplayRunner {
+public:
+	static void Init();
+	static void Run(const std::string& file, ReplayResult& result, std::vector<ReplayStep>* trace = 0);
+	// Runs the file with the default scripts and again with the scripts below
+	// candidate, and reports the first message that differs.
+	static void Compare(const std::string& file, const std::string& candidate, ReplayResult& result);
+	// Runs the files on the given number of threads, done is called once per file.
+	// With a candidate tree every file is compared instead.
+	static void RunAll(const std::vector<std::string>& files, int threads, const char* candidate, const std::function<void(const ReplayResult&)>& done);
+
+private:
+	static bool StartDuel(Replay& replay, long& pduel);
+	static bool Analyze(Replay& replay, long pduel, char* msg, unsigned int len, ReplayResult& result, std::vector<ReplayStep>* trace);
+	static byte* ScriptReader(const char* script_name, int* slen);
+	static int MessageHandler(long fduel, int type);
+
+	static std::mutex engine_mutex;
+	// script tree of the running duel, empty for the default one
+	static thread_local std::string script_root;
+};
+
+}
+
+#endif //REPLAY_RUNNER_H
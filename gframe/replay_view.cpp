@@ -0,0 +1,38 @@
+#include "replay_view.h"
+#include <string.h>
+#include <algorithm>
+
+namespace ygo {
+
+void ReplayView::Clear() {
+	records.clear();
+	keyframes.clear();
+}
+const ViewKeyframe* ReplayView::FindKeyframe(int step) const {
+	if(keyframes.empty())
+		return 0;
+	auto kit = std::lower_bound(keyframes.begin(), keyframes.end(), step, [](const ViewKeyframe& keyframe, int step) {
+		return keyframe.step < step;
+	});
+	if(kit == keyframes.begin())
+		return &keyframes[0];
+	return &(*(kit - 1));
+}
+void ReplayView::Write(std::vector<unsigned char>& out, unsigned char type, const unsigned char* head, int head_len, const unsigned char* data, int len) {
+	int size = head_len + len;
+	out.push_back(type);
+	out.insert(out.end(), (const unsigned char*)&size, (const unsigned char*)&size + sizeof(size));
+	out.insert(out.end(), head, head + head_len);
+	out.insert(out.end(), data, data + len);
+}
+bool ReplayView::Read(const std::vector<unsigned char>& in, size_t& pos, unsigned char& type, const unsigned char*& data, int& len) {
+	if(pos + 1 + sizeof(len) > in.size())
+		return false;
+	type = in[pos];
+	memcpy(&len, &in[pos + 1], sizeof(len));
+	data = &in[pos + 1 + sizeof(len)];
+	pos += 1 + sizeof(len) + len;
+	return true;
+}
+
+}
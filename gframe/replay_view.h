@@ -0,0 +1,46 @@
+#ifndef REPLAY_VIEW_H
+#define REPLAY_VIEW_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace ygo {
+
+// records of the client side of a replay
+#define VIEW_MESSAGE		1	// message given to DuelClient::ClientAnalyze
+#define VIEW_STEP			2	// a replay step ends here
+#define VIEW_FIELD			3	// player, location, query_field_card result
+#define VIEW_CARD			4	// player, location, sequence, query_card result
+#define VIEW_REFRESH_ALL	5	// ClientField::RefreshAllCards
+
+// most steps replayed to go back one
+#define VIEW_KEYFRAME_STEPS	16
+
+struct ViewKeyframe {
+	size_t offset;	// first record played after the keyframe
+	int step;
+	int turn;
+	bool tag_player[2];
+	std::vector<unsigned char> reload;	// MSG_RELOAD_FIELD from query_field_info
+	std::vector<unsigned char> field;	// VIEW_FIELD records of every location
+};
+
+// Everything ReplayMode fed to the client field, with a keyframe at the start
+// of every turn and every VIEW_KEYFRAME_STEPS steps. Going back only replays
+// the records after the nearest keyframe instead of running the duel again.
+class ReplayView {
+public:
+	void Clear();
+	// the last keyframe before step, or the first one; null if there is none
+	const ViewKeyframe* FindKeyframe(int step) const;
+	static void Write(std::vector<unsigned char>& out, unsigned char type, const unsigned char* head, int head_len, const unsigned char* data, int len);
+	// reads the record at pos and moves past it, false at the end
+	static bool Read(const std::vector<unsigned char>& in, size_t& pos, unsigned char& type, const unsigned char*& data, int& len);
+
+	std::vector<unsigned char> records;
+	std::vector<ViewKeyframe> keyframes;
+};
+
+}
+
+#endif //REPLAY_VIEW_H
@@ -0,0 +1,140 @@
+#include "config.h"
+#include "netserver.h"
+#include "data_manager.h"
+#include "deck_manager.h"
+#include "startup_profile.h"
+#include <event2/thread.h>
+#include <signal.h>
+#include <chrono>
+
+int enable_log = 0;
+bool exit_on_return = false;
+bool open_file = false;
+wchar_t open_file_name[256] = L"";
+bool bot_mode = false;
+bool prefer_expansion_script = false;
+
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t stats_requested = 0;
+
+static void OnStopSignal(int sig) {
+	stop_requested = 1;
+}
+static void OnStatsSignal(int sig) {
+	stats_requested = 1;
+}
+static void PrintRoomStats() {
+	std::vector<ygo::RoomStat> stats;
+	ygo::NetServer::GetRoomStats(stats);
+	fprintf(stderr, "%d room(s)\n", (int)stats.size());
+	for(auto sit = stats.begin(); sit != stats.end(); ++sit)
+		fprintf(stderr, "  room %u: worker %d, stage %d, queue depth %d\n", sit->gameid, sit->worker, sit->duel_stage, sit->queue_depth);
+}
+
+static void PrintUsage(const char* name) {
+	fprintf(stderr, "Usage: %s [-p port] [-t threads] [-j threads] [-e database] [-x] [-l] [--profile-startup[=file]]\n", name);
+	fprintf(stderr, "  -p port      listen port (default 7911)\n");
+	fprintf(stderr, "  -t threads   network worker threads (default: one per core)\n");
+	fprintf(stderr, "  -j threads   duel engine threads, 0 runs the engine on the network threads\n");
+	fprintf(stderr, "  -e database  load an extra card database, may be repeated\n");
+	fprintf(stderr, "  -x           prefer scripts in ./expansions\n");
+	fprintf(stderr, "  -l           print script error logs to stderr\n");
+	fprintf(stderr, "  --profile-startup[=file]\n");
+	fprintf(stderr, "               print the time of each startup phase, and write it to file as json\n");
+}
+
+static void LoadExpansions() {
+	FileSystem::TraversalDir("./expansions", [](const char* name, bool isdir) {
+		if(!isdir && strrchr(name, '.') && !mystrncasecmp(strrchr(name, '.'), ".cdb", 4)) {
+			char fpath[1024];
+			snprintf(fpath, sizeof(fpath), "./expansions/%s", name);
+			ygo::dataManager.QueueDB(fpath);
+		}
+	});
+}
+
+int main(int argc, char* argv[]) {
+#ifndef _WIN32
+	setlocale(LC_CTYPE, "UTF-8");
+#endif
+	unsigned short port = 7911;
+	int threads = std::thread::hardware_concurrency();
+	int engine_threads = threads;
+	std::vector<const char*> extra_db;
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "-p") && i + 1 < argc) {
+			port = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-j") && i + 1 < argc) {
+			engine_threads = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-e") && i + 1 < argc) {
+			extra_db.push_back(argv[++i]);
+		} else if(!strcmp(argv[i], "-x")) {
+			prefer_expansion_script = true;
+		} else if(!strcmp(argv[i], "-l")) {
+			enable_log = 1;
+		} else if(ygo::StartupProfile::ParseArg(argv[i])) {
+		} else {
+			PrintUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+#ifdef _WIN32
+	WORD wVersionRequested;
+	WSADATA wsaData;
+	wVersionRequested = MAKEWORD(2, 2);
+	WSAStartup(wVersionRequested, &wsaData);
+	evthread_use_windows_threads();
+#else
+	evthread_use_pthreads();
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGUSR1, OnStatsSignal);
+#endif //_WIN32
+	signal(SIGINT, OnStopSignal);
+	signal(SIGTERM, OnStopSignal);
+	ygo::StartupProfile::Begin("startup");
+	ygo::ProfileScope phase("lflist");
+	ygo::deckManager.LoadLFList();
+	phase.Next("card databases");
+	LoadExpansions();
+	if(!ygo::dataManager.QueueDB("cards.cdb")) {
+		fprintf(stderr, "Failed to load card database (cards.cdb)!\n");
+		return EXIT_FAILURE;
+	}
+	for(auto dbit = extra_db.begin(); dbit != extra_db.end(); ++dbit) {
+		if(!ygo::dataManager.QueueDB(*dbit))
+			fprintf(stderr, "Failed to load card database (%s)!\n", *dbit);
+	}
+	if(!ygo::dataManager.LoadQueuedDBs())
+		fprintf(stderr, "Failed to read some card databases!\n");
+	phase.End();
+	if(threads < 1)
+		threads = 1;
+	phase.Next("listen");
+	ygo::EnginePool::Start(engine_threads);
+	if(!ygo::NetServer::StartServer(port, true, threads)) {
+		fprintf(stderr, "Failed to listen on port %d!\n", port);
+		ygo::EnginePool::Stop();
+		return EXIT_FAILURE;
+	}
+	ygo::StartupProfile::Report();
+	fprintf(stderr, "Listening on port %d with %d worker(s), %d engine thread(s)\n", port, threads, engine_threads > 0 ? engine_threads : 0);
+	bool stopping = false;
+	while(ygo::NetServer::IsRunning()) {
+		if(stop_requested && !stopping) {
+			stopping = true;
+			ygo::NetServer::StopServer();
+		}
+		if(stats_requested) {
+			stats_requested = 0;
+			PrintRoomStats();
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+	ygo::EnginePool::Stop();
+#ifdef _WIN32
+	WSACleanup();
+#endif //_WIN32
+	return EXIT_SUCCESS;
+}
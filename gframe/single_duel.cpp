@@ -1,6 +1,10 @@
 #include "single_duel.h"
 #include "netserver.h"
+#include "field_mask.h"
+#include "msg_desc.h"
+#ifndef YGOPRO_SERVER_MODE
 #include "game.h"
+#endif
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/common.h"
 #include "../ocgcore/mtrandom.h"
@@ -16,6 +20,7 @@ SingleDuel::SingleDuel(bool is_match) {
 	}
 	duel_count = 0;
 	memset(match_result, 0, 3);
+	memset(refresh_flag, 0, sizeof(refresh_flag));
 }
 SingleDuel::~SingleDuel() {
 }
@@ -91,6 +96,8 @@ void SingleDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 		}
 	} else {
 		observers.insert(dp);
+		if(pduel)
+			ResetFieldViews();
 		dp->type = NETPLAYER_TYPE_OBSERVER;
 		sctc.type |= NETPLAYER_TYPE_OBSERVER;
 		STOC_HS_WatchChange scwc;
@@ -135,7 +142,7 @@ void SingleDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 void SingleDuel::LeaveGame(DuelPlayer* dp) {
 	if(dp == host_player) {
 		EndDuel();
-		NetServer::StopServer();
+		NetServer::CloseRoom(this);
 	} else if(dp->type == NETPLAYER_TYPE_OBSERVER) {
 		observers.erase(dp);
 		if(duel_stage == DUEL_STAGE_BEGIN) {
@@ -433,11 +440,13 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	}
 	time_limit[0] = host_info.time_limit;
 	time_limit[1] = host_info.time_limit;
+	rnd.reset(seed);
+	engine_mutex.lock();
 	set_script_reader((script_reader)DataManager::ScriptReaderEx);
 	set_card_reader((card_reader)DataManager::CardReader);
 	set_message_handler((message_handler)SingleDuel::MessageHandler);
-	rnd.reset(seed);
 	pduel = create_duel(rnd.rand());
+	engine_mutex.unlock();
 	set_player_info(pduel, 0, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	set_player_info(pduel, 1, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	int opt = (int)host_info.duel_rule << 16;
@@ -487,10 +496,11 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	else startbuf[1] = 0x11;
 	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 		NetServer::SendBufferToPlayer(*oit, STOC_GAME_MSG, startbuf, 19);
+	ResetFieldViews();
 	RefreshExtra(0);
 	RefreshExtra(1);
 	start_duel(pduel, opt);
-	Process();
+	NetServer::ProcessDuel(this);
 }
 void SingleDuel::Process() {
 	char engineBuffer[0x1000];
@@ -507,6 +517,7 @@ void SingleDuel::Process() {
 			stop = Analyze(engineBuffer, engLen);
 		}
 	}
+	FlushRefresh();
 	if(stop == 2)
 		DuelEndProc();
 }
@@ -581,6 +592,34 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 	while (pbuf - msgbuffer < (int)len) {
 		offset = pbuf;
 		unsigned char engType = BufferIO::ReadUInt8(pbuf);
+		if(!FieldDelta::KeepsField(engType))
+			ResetFieldViews();
+		const MessageDesc* desc = MessageDesc::Get(engType);
+		if(desc && desc->route != MSG_ROUTE_CUSTOM) {
+			int body_len = desc->length(pbuf, len - (pbuf - msgbuffer));
+			if(body_len < 0)
+				return 0;
+			pbuf += body_len;
+			if(desc->route == MSG_ROUTE_NONE)
+				continue;
+			if(desc->route == MSG_ROUTE_PLAYER) {
+				player = offset[1];
+				if(!(desc->flags & MSG_FLAG_RESPONSE)) {
+					NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
+					continue;
+				}
+				RefreshLocations(desc->refresh);
+				WaitforResponse(player);
+				NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
+				return 1;
+			}
+			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
+			NetServer::ReSendToPlayer(players[1]);
+			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
+				NetServer::ReSendToPlayer(*oit);
+			RefreshLocations(desc->refresh);
+			continue;
+		}
 		switch (engType) {
 		case MSG_RETRY: {
 			WaitforResponse(last_response);
@@ -623,6 +662,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 		case MSG_WIN: {
 			player = BufferIO::ReadInt8(pbuf);
 			type = BufferIO::ReadInt8(pbuf);
+			FlushRefresh();
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
 			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
@@ -640,68 +680,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			EndDuel();
 			return 2;
 		}
-		case MSG_SELECT_BATTLECMD: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 11;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 8 + 2;
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_SELECT_IDLECMD: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 11 + 3;
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_SELECT_EFFECTYN: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 12;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_SELECT_YESNO: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 4;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_SELECT_OPTION: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
 		case MSG_SELECT_CARD:
 		case MSG_SELECT_TRIBUTE: {
 			player = BufferIO::ReadInt8(pbuf);
@@ -749,38 +727,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
 			return 1;
 		}
-		case MSG_SELECT_CHAIN: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += 10 + count * 13;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_SELECT_PLACE:
-		case MSG_SELECT_DISFIELD: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 5;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_SELECT_POSITION: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 5;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_SELECT_COUNTER: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 4;
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 9;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
 		case MSG_SELECT_SUM: {
 			pbuf++;
 			player = BufferIO::ReadInt8(pbuf);
@@ -793,34 +739,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
 			return 1;
 		}
-		case MSG_SORT_CARD: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_CONFIRM_DECKTOP: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_CONFIRM_EXTRATOP: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 7;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for (auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
 		case MSG_CONFIRM_CARDS: {
 			player = BufferIO::ReadInt8(pbuf);
 			count = BufferIO::ReadInt8(pbuf);
@@ -836,14 +754,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			}
 			break;
 		}
-		case MSG_SHUFFLE_DECK: {
-			player = BufferIO::ReadInt8(pbuf);
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
 		case MSG_SHUFFLE_HAND: {
 			player = BufferIO::ReadInt8(pbuf);
 			count = BufferIO::ReadInt8(pbuf);
@@ -868,14 +778,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			RefreshExtra(player);
 			break;
 		}
-		case MSG_REFRESH_DECK: {
-			pbuf++;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
 		case MSG_SWAP_GRAVE_DECK: {
 			player = BufferIO::ReadInt8(pbuf);
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
@@ -885,21 +787,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			RefreshGrave(player);
 			break;
 		}
-		case MSG_REVERSE_DECK: {
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_DECK_TOP: {
-			pbuf += 6;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
 		case MSG_SHUFFLE_SET_CARD: {
 			int loc = BufferIO::ReadInt8(pbuf);
 			count = BufferIO::ReadInt8(pbuf);
@@ -928,26 +815,13 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf++;
 			time_limit[0] = host_info.time_limit;
 			time_limit[1] = host_info.time_limit;
+			FlushRefresh();
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
 			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 				NetServer::ReSendToPlayer(*oit);
 			break;
 		}
-		case MSG_NEW_PHASE: {
-			pbuf += 2;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
-			break;
-		}
 		case MSG_MOVE: {
 			pbufw = pbuf;
 			int pc = pbuf[4];
@@ -1009,52 +883,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			RefreshSingle(c2, l2, s2);
 			break;
 		}
-		case MSG_FIELD_DISABLED: {
-			pbuf += 4;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_SUMMONING: {
-			pbuf += 8;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_SUMMONED: {
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			break;
-		}
-		case MSG_SPSUMMONING: {
-			pbuf += 8;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_SPSUMMONED: {
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			break;
-		}
 		case MSG_FLIPSUMMONING: {
 			RefreshSingle(pbuf[4], pbuf[5], pbuf[6]);
 			pbuf += 8;
@@ -1064,115 +892,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 				NetServer::ReSendToPlayer(*oit);
 			break;
 		}
-		case MSG_FLIPSUMMONED: {
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			break;
-		}
-		case MSG_CHAINING: {
-			pbuf += 16;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_CHAINED: {
-			pbuf++;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
-			break;
-		}
-		case MSG_CHAIN_SOLVING: {
-			pbuf++;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_CHAIN_SOLVED: {
-			pbuf++;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
-			break;
-		}
-		case MSG_CHAIN_END: {
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
-			break;
-		}
-		case MSG_CHAIN_NEGATED: {
-			pbuf++;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_CHAIN_DISABLED: {
-			pbuf++;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_CARD_SELECTED: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			break;
-		}
-		case MSG_RANDOM_SELECTED: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_BECOME_TARGET: {
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count * 4;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
 		case MSG_DRAW: {
 			player = BufferIO::ReadInt8(pbuf);
 			count = BufferIO::ReadInt8(pbuf);
@@ -1190,206 +909,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 				NetServer::ReSendToPlayer(*oit);
 			break;
 		}
-		case MSG_DAMAGE: {
-			pbuf += 5;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_RECOVER: {
-			pbuf += 5;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_EQUIP: {
-			pbuf += 8;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_LPUPDATE: {
-			pbuf += 5;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_UNEQUIP: {
-			pbuf += 4;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_CARD_TARGET: {
-			pbuf += 8;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_CANCEL_TARGET: {
-			pbuf += 8;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_PAY_LPCOST: {
-			pbuf += 5;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_ADD_COUNTER: {
-			pbuf += 7;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_REMOVE_COUNTER: {
-			pbuf += 7;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_ATTACK: {
-			pbuf += 8;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_BATTLE: {
-			pbuf += 26;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_ATTACK_DISABLED: {
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_DAMAGE_STEP_START: {
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			break;
-		}
-		case MSG_DAMAGE_STEP_END: {
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			break;
-		}
-		case MSG_MISSED_EFFECT: {
-			player = pbuf[0];
-			pbuf += 8;
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			break;
-		}
-		case MSG_TOSS_COIN: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_TOSS_DICE: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadInt8(pbuf);
-			pbuf += count;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_ROCK_PAPER_SCISSORS: {
-			player = BufferIO::ReadInt8(pbuf);
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_HAND_RES: {
-			pbuf += 1;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for (auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_ANNOUNCE_RACE: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 5;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_ANNOUNCE_ATTRIB: {
-			player = BufferIO::ReadInt8(pbuf);
-			pbuf += 5;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_ANNOUNCE_CARD:
-		case MSG_ANNOUNCE_NUMBER: {
-			player = BufferIO::ReadInt8(pbuf);
-			count = BufferIO::ReadUInt8(pbuf);
-			pbuf += 4 * count;
-			WaitforResponse(player);
-			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
-			return 1;
-		}
-		case MSG_CARD_HINT: {
-			pbuf += 9;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
-		case MSG_PLAYER_HINT: {
-			pbuf += 6;
-			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			break;
-		}
 		case MSG_MATCH_KILL: {
 			int code = BufferIO::ReadInt32(pbuf);
 			if(match_mode) {
@@ -1408,7 +927,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 void SingleDuel::GetResponse(DuelPlayer* dp, void* pdata, unsigned int len) {
 	byte resb[64];
 	memcpy(resb, pdata, len);
-	last_replay.WriteInt8(len);
+	last_replay.WriteInt8(len, false);
 	last_replay.WriteData(resb, len);
 	set_responseb(pduel, resb);
 	players[dp->type]->state = 0xff;
@@ -1418,24 +937,31 @@ void SingleDuel::GetResponse(DuelPlayer* dp, void* pdata, unsigned int len) {
 		else time_limit[dp->type] = 0;
 		event_del(etimer);
 	}
-	Process();
+	NetServer::ProcessDuel(this);
 }
 void SingleDuel::EndDuel() {
 	if(!pduel)
 		return;
+	FlushRefresh();
 	last_replay.EndRecord();
-	char replaybuf[0x2000], *pbuf = replaybuf;
-	memcpy(pbuf, &last_replay.pheader, sizeof(ReplayHeader));
-	pbuf += sizeof(ReplayHeader);
-	memcpy(pbuf, last_replay.comp_data, last_replay.comp_size);
-	NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, sizeof(ReplayHeader) + last_replay.comp_size);
-	NetServer::ReSendToPlayer(players[1]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		NetServer::ReSendToPlayer(*oit);
+	// clients read a whole packet into 0x2000 bytes, longer replays are not sent
+	char replaybuf[0x2000 - 3], *pbuf = replaybuf;
+	if(sizeof(ReplayHeader) + last_replay.comp_size <= sizeof(replaybuf)) {
+		memcpy(pbuf, &last_replay.pheader, sizeof(ReplayHeader));
+		pbuf += sizeof(ReplayHeader);
+		memcpy(pbuf, last_replay.comp_data.data(), last_replay.comp_size);
+		NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, sizeof(ReplayHeader) + last_replay.comp_size);
+		NetServer::ReSendToPlayer(players[1]);
+		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
+			NetServer::ReSendToPlayer(*oit);
+	}
+	engine_mutex.lock();
 	end_duel(pduel);
+	engine_mutex.unlock();
 	pduel = 0;
 }
 void SingleDuel::WaitforResponse(int playerid) {
+	FlushRefresh();
 	last_response = playerid;
 	unsigned char msg = MSG_WAITING;
 	NetServer::SendPacketToPlayer(players[1 - playerid], STOC_GAME_MSG, msg);
@@ -1460,94 +986,120 @@ void SingleDuel::TimeConfirm(DuelPlayer* dp) {
 	event_add(etimer, &timeout);
 }
 void SingleDuel::RefreshMzone(int player, int flag, int use_cache) {
+	MarkRefresh(player, 0, flag, use_cache);
+}
+void SingleDuel::RefreshSzone(int player, int flag, int use_cache) {
+	MarkRefresh(player, 1, flag, use_cache);
+}
+void SingleDuel::RefreshHand(int player, int flag, int use_cache) {
+	MarkRefresh(player, 2, flag, use_cache);
+}
+void SingleDuel::RefreshGrave(int player, int flag, int use_cache) {
+	MarkRefresh(player, 3, flag, use_cache);
+}
+void SingleDuel::RefreshExtra(int player, int flag, int use_cache) {
+	MarkRefresh(player, 4, flag, use_cache);
+}
+void SingleDuel::MarkRefresh(int player, int index, int flag, int use_cache) {
+	if(!refresh_flag[player][index])
+		refresh_cache[player][index] = use_cache;
+	else if(!use_cache)
+		refresh_cache[player][index] = 0;
+	refresh_flag[player][index] |= flag;
+}
+void SingleDuel::FlushRefresh() {
+	for(int i = 0; i < 5; ++i) {
+		for(int p = 0; p < 2; ++p) {
+			int flag = refresh_flag[p][i];
+			if(!flag)
+				continue;
+			refresh_flag[p][i] = 0;
+			if(!pduel)
+				continue;
+			switch(i) {
+			case 0: SendMzone(p, flag, refresh_cache[p][i]); break;
+			case 1: SendSzone(p, flag, refresh_cache[p][i]); break;
+			case 2: SendHand(p, flag, refresh_cache[p][i]); break;
+			case 3: SendGrave(p, flag, refresh_cache[p][i]); break;
+			case 4: SendExtra(p, flag, refresh_cache[p][i]); break;
+			}
+		}
+	}
+}
+void SingleDuel::SendMzone(int player, int flag, int use_cache) {
 	char query_buffer[0x2000];
 	char* qbuf = query_buffer;
 	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_MZONE);
 	int len = query_field_card(pduel, player, LOCATION_MZONE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
-	int qlen = 0;
-	while(qlen < len) {
-		int clen = BufferIO::ReadInt32(qbuf);
-		qlen += clen;
-		if (clen == 4)
-			continue;
-		if (qbuf[11] & POS_FACEDOWN)
-			memset(qbuf, 0, clen - 4);
-		qbuf += clen - 4;
-	}
-	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, query_buffer, len + 3);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	NetServer::SendUpdateData(field_view[player][0][0], query_buffer, len + 3, &players[player], 1);
+	char public_buffer[0x2000];
+	int plen = FieldMask::BuildPublic(query_buffer, len + 3, public_buffer);
+	NetServer::SendUpdateData(field_view[player][0][1], public_buffer, plen, &players[1 - player], 1, &observers);
 }
-void SingleDuel::RefreshSzone(int player, int flag, int use_cache) {
+void SingleDuel::SendSzone(int player, int flag, int use_cache) {
 	char query_buffer[0x2000];
 	char* qbuf = query_buffer;
 	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_SZONE);
 	int len = query_field_card(pduel, player, LOCATION_SZONE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
-	int qlen = 0;
-	while(qlen < len) {
-		int clen = BufferIO::ReadInt32(qbuf);
-		qlen += clen;
-		if (clen == 4)
-			continue;
-		if (qbuf[11] & POS_FACEDOWN)
-			memset(qbuf, 0, clen - 4);
-		qbuf += clen - 4;
-	}
-	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, query_buffer, len + 3);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	NetServer::SendUpdateData(field_view[player][1][0], query_buffer, len + 3, &players[player], 1);
+	char public_buffer[0x2000];
+	int plen = FieldMask::BuildPublic(query_buffer, len + 3, public_buffer);
+	NetServer::SendUpdateData(field_view[player][1][1], public_buffer, plen, &players[1 - player], 1, &observers);
 }
-void SingleDuel::RefreshHand(int player, int flag, int use_cache) {
+void SingleDuel::SendHand(int player, int flag, int use_cache) {
 	char query_buffer[0x2000];
 	char* qbuf = query_buffer;
 	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_HAND);
 	int len = query_field_card(pduel, player, LOCATION_HAND, flag | QUERY_POSITION, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
-	int qlen = 0;
-	while(qlen < len) {
-		int slen = BufferIO::ReadInt32(qbuf);
-		int qflag = *(int*)qbuf;
-		int offset = 8;
-		if(!(qflag & QUERY_CODE))
-			offset -= 4;
-		unsigned position = ((*(int*)(qbuf + offset)) >> 24) & 0xff;
-		if(!(position & POS_FACEUP))
-			memset(qbuf, 0, slen - 4);
-		qbuf += slen - 4;
-		qlen += slen;
-	}
-	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, query_buffer, len + 3);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	NetServer::SendUpdateData(field_view[player][2][0], query_buffer, len + 3, &players[player], 1);
+	char public_buffer[0x2000];
+	int plen = FieldMask::BuildPublic(query_buffer, len + 3, public_buffer);
+	NetServer::SendUpdateData(field_view[player][2][1], public_buffer, plen, &players[1 - player], 1, &observers);
 }
-void SingleDuel::RefreshGrave(int player, int flag, int use_cache) {
+void SingleDuel::SendGrave(int player, int flag, int use_cache) {
 	char query_buffer[0x2000];
 	char* qbuf = query_buffer;
 	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_GRAVE);
 	int len = query_field_card(pduel, player, LOCATION_GRAVE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, query_buffer, len + 3);
-	NetServer::ReSendToPlayer(players[1]);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	NetServer::SendUpdateData(field_view[player][3][0], query_buffer, len + 3, players, 2, &observers);
 }
-void SingleDuel::RefreshExtra(int player, int flag, int use_cache) {
+void SingleDuel::SendExtra(int player, int flag, int use_cache) {
 	char query_buffer[0x2000];
 	char* qbuf = query_buffer;
 	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_EXTRA);
 	int len = query_field_card(pduel, player, LOCATION_EXTRA, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
+	NetServer::SendUpdateData(field_view[player][4][0], query_buffer, len + 3, &players[player], 1);
+}
+void SingleDuel::ResetFieldViews() {
+	for(int p = 0; p < 2; ++p)
+		for(int i = 0; i < 5; ++i) {
+			field_view[p][i][0].Reset();
+			field_view[p][i][1].Reset();
+		}
+}
+void SingleDuel::RefreshLocations(unsigned char refresh) {
+	if(refresh & MSG_REFRESH_MZONE) {
+		RefreshMzone(0);
+		RefreshMzone(1);
+	}
+	if(refresh & MSG_REFRESH_SZONE) {
+		RefreshSzone(0);
+		RefreshSzone(1);
+	}
+	if(refresh & MSG_REFRESH_HAND) {
+		RefreshHand(0);
+		RefreshHand(1);
+	}
 }
 void SingleDuel::RefreshSingle(int player, int location, int sequence, int flag) {
 	char query_buffer[0x2000];
@@ -1557,6 +1109,7 @@ void SingleDuel::RefreshSingle(int player, int location, int sequence, int flag)
 	BufferIO::WriteInt8(qbuf, location);
 	BufferIO::WriteInt8(qbuf, sequence);
 	int len = query_card(pduel, player, location, sequence, flag, (unsigned char*)qbuf, 0);
+	ResetFieldViews();
 	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 4);
 	if(location == LOCATION_REMOVED && (qbuf[15] & POS_FACEDOWN))
 		return;
@@ -1571,7 +1124,11 @@ int SingleDuel::MessageHandler(long fduel, int type) {
 		return 0;
 	char msgbuf[1024];
 	get_log_message(fduel, (byte*)msgbuf);
+#ifdef YGOPRO_SERVER_MODE
+	fprintf(stderr, "%s\n", msgbuf);
+#else
 	mainGame->AddDebugMsg(msgbuf);
+#endif
 	return 0;
 }
 void SingleDuel::SingleTimer(evutil_socket_t fd, short events, void* arg) {
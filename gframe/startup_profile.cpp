@@ -0,0 +1,159 @@
+#include "config.h"
+#include "startup_profile.h"
+#include <atomic>
+#include <new>
+
+static std::atomic<unsigned long long> alloc_count(0);
+static std::atomic<unsigned long long> alloc_bytes(0);
+
+#ifdef YGOPRO_STARTUP_PROFILE_ALLOCS
+// the global allocator is only replaced in builds made to profile it
+static std::atomic<bool> count_allocs(false);
+
+static void* CountedAlloc(size_t size) {
+	if(count_allocs.load(std::memory_order_relaxed)) {
+		alloc_count.fetch_add(1, std::memory_order_relaxed);
+		alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	if(!size)
+		size = 1;
+	void* p;
+	while(!(p = malloc(size))) {
+		std::new_handler handler = std::get_new_handler();
+		if(!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+	return p;
+}
+
+void* operator new(size_t size) {
+	return CountedAlloc(size);
+}
+void* operator new[](size_t size) {
+	return CountedAlloc(size);
+}
+void operator delete(void* p) noexcept {
+	free(p);
+}
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
+#endif
+
+namespace ygo {
+
+bool StartupProfile::enabled = false;
+std::string StartupProfile::json_file;
+std::vector<ProfilePhase> StartupProfile::phases;
+std::vector<size_t> StartupProfile::open_phases;
+
+// bytes the process has read so far, from files and sockets alike
+static unsigned long long ReadBytes() {
+#ifdef _WIN32
+	IO_COUNTERS counters;
+	if(GetProcessIoCounters(GetCurrentProcess(), &counters))
+		return counters.ReadTransferCount;
+	return 0;
+#else
+	unsigned long long rchar = 0;
+	FILE* fp = fopen("/proc/self/io", "r");
+	if(!fp)
+		return 0;
+	char line[128];
+	while(fgets(line, sizeof(line), fp)) {
+		if(sscanf(line, "rchar: %llu", &rchar) == 1)
+			break;
+	}
+	fclose(fp);
+	return rchar;
+#endif
+}
+
+bool StartupProfile::ParseArg(const char* arg) {
+	if(strncmp(arg, "--profile-startup", 17) || (arg[17] && arg[17] != '='))
+		return false;
+	if(arg[17] == '=')
+		json_file = arg + 18;
+	enabled = true;
+#ifdef YGOPRO_STARTUP_PROFILE_ALLOCS
+	count_allocs = true;
+#endif
+	return true;
+}
+void StartupProfile::Begin(const char* name) {
+	if(!enabled)
+		return;
+	ProfilePhase phase;
+	phase.name = name;
+	phase.depth = (int)open_phases.size();
+	phase.wall_ms = 0;
+	phase.read_bytes = ReadBytes();
+	phase.allocs = alloc_count.load(std::memory_order_relaxed);
+	phase.alloc_bytes = alloc_bytes.load(std::memory_order_relaxed);
+	open_phases.push_back(phases.size());
+	phases.push_back(phase);
+	// started last so the readings above are not timed
+	phases.back().start = std::chrono::steady_clock::now();
+}
+void StartupProfile::End() {
+	if(!enabled || open_phases.empty())
+		return;
+	auto now = std::chrono::steady_clock::now();
+	ProfilePhase& phase = phases[open_phases.back()];
+	open_phases.pop_back();
+	phase.wall_ms = std::chrono::duration<double, std::milli>(now - phase.start).count();
+	phase.read_bytes = ReadBytes() - phase.read_bytes;
+	phase.allocs = alloc_count.load(std::memory_order_relaxed) - phase.allocs;
+	phase.alloc_bytes = alloc_bytes.load(std::memory_order_relaxed) - phase.alloc_bytes;
+}
+void StartupProfile::Report() {
+	if(!enabled)
+		return;
+	while(!open_phases.empty())
+		End();
+	enabled = false;
+#ifdef YGOPRO_STARTUP_PROFILE_ALLOCS
+	count_allocs = false;
+	fprintf(stderr, "%-32s %10s %12s %10s %12s\n", "phase", "ms", "read", "allocs", "alloc bytes");
+#else
+	fprintf(stderr, "%-32s %10s %12s\n", "phase", "ms", "read");
+#endif
+	for(auto pit = phases.begin(); pit != phases.end(); ++pit) {
+		std::string name(pit->depth * 2, ' ');
+		name += pit->name;
+#ifdef YGOPRO_STARTUP_PROFILE_ALLOCS
+		fprintf(stderr, "%-32s %10.1f %12llu %10llu %12llu\n", name.c_str(), pit->wall_ms, pit->read_bytes, pit->allocs, pit->alloc_bytes);
+#else
+		fprintf(stderr, "%-32s %10.1f %12llu\n", name.c_str(), pit->wall_ms, pit->read_bytes);
+#endif
+	}
+	if(!json_file.empty() && !WriteJson(json_file.c_str()))
+		fprintf(stderr, "Cannot write %s\n", json_file.c_str());
+}
+bool StartupProfile::WriteJson(const char* file) {
+	FILE* fp = fopen(file, "w");
+	if(!fp)
+		return false;
+	// phase names are literals from the source, nothing to escape
+	fprintf(fp, "{\"phases\": [");
+	for(size_t i = 0; i < phases.size(); ++i) {
+		const ProfilePhase& phase = phases[i];
+		fprintf(fp, "%s\n  {\"name\": \"%s\", \"depth\": %d, \"wall_ms\": %.3f, \"read_bytes\": %llu",
+		        i ? "," : "", phase.name, phase.depth, phase.wall_ms, phase.read_bytes);
+#ifdef YGOPRO_STARTUP_PROFILE_ALLOCS
+		fprintf(fp, ", \"allocs\": %llu, \"alloc_bytes\": %llu", phase.allocs, phase.alloc_bytes);
+#endif
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "\n]}\n");
+	return fclose(fp) == 0;
+}
+
+}
@@ -0,0 +1,74 @@
+#ifndef STARTUP_PROFILE_H
+#define STARTUP_PROFILE_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace ygo {
+
+struct ProfilePhase {
+	const char* name;
+	int depth;
+	std::chrono::steady_clock::time_point start;
+	double wall_ms;
+	unsigned long long read_bytes;
+	unsigned long long allocs;
+	unsigned long long alloc_bytes;
+};
+
+// Time, bytes read and heap allocations of each startup phase. Phases nest and
+// are reported in the order they began. Nothing is recorded unless the program
+// was started with --profile-startup. Allocations are only counted in builds
+// with YGOPRO_STARTUP_PROFILE_ALLOCS, and only until the report is written.
+class StartupProfile {
+public:
+	// --profile-startup prints the report to stderr, --profile-startup=file
+	// also writes it to file as json; false if arg is neither
+	static bool ParseArg(const char* arg);
+	static bool IsEnabled() { return enabled; }
+	static void Begin(const char* name);
+	static void End();
+	// ends the phases still open, prints the report and stops counting
+	static void Report();
+
+private:
+	static bool WriteJson(const char* file);
+
+	static bool enabled;
+	static std::string json_file;
+	static std::vector<ProfilePhase> phases;
+	static std::vector<size_t> open_phases;
+};
+
+// Times a run of phases; whatever phase is open ends with the scope, so an
+// early return does not leave it running.
+class ProfileScope {
+public:
+	explicit ProfileScope(const char* name): open(true) {
+		StartupProfile::Begin(name);
+	}
+	~ProfileScope() {
+		End();
+	}
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+	// ends the open phase, if any, and begins name
+	void Next(const char* name) {
+		End();
+		StartupProfile::Begin(name);
+		open = true;
+	}
+	void End() {
+		if(open)
+			StartupProfile::End();
+		open = false;
+	}
+
+private:
+	bool open;
+};
+
+}
+
+#endif //STARTUP_PROFILE_H
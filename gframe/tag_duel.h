@@ -4,6 +4,8 @@
 #include "config.h"
 #include "network.h"
 #include "replay.h"
+#include "field_delta.h"
+#include <set>
 
 namespace ygo {
 
@@ -36,12 +38,23 @@ public:
 	void RefreshHand(int player, int flag = 0x781fff, int use_cache = 1);
 	void RefreshGrave(int player, int flag = 0x81fff, int use_cache = 1);
 	void RefreshExtra(int player, int flag = 0x81fff, int use_cache = 1);
+	// refreshes the MSG_REFRESH_* locations of both players
+	void RefreshLocations(unsigned char refresh);
 	void RefreshSingle(int player, int location, int sequence, int flag = 0xf81fff);
+	void FlushRefresh();
 
 	static int MessageHandler(long fduel, int type);
 	static void TagTimer(evutil_socket_t fd, short events, void* arg);
 	
 protected:
+	void MarkRefresh(int player, int index, int flag, int use_cache);
+	void SendMzone(int player, int flag, int use_cache);
+	void SendSzone(int player, int flag, int use_cache);
+	void SendHand(int player, int flag, int use_cache);
+	void SendGrave(int player, int flag, int use_cache);
+	void SendExtra(int player, int flag, int use_cache);
+	void ResetFieldViews();
+
 	DuelPlayer* players[4];
 	DuelPlayer* pplayer[4];
 	DuelPlayer* cur_player[2];
@@ -55,6 +68,11 @@ protected:
 	unsigned char turn_count;
 	unsigned short time_limit[2];
 	unsigned short time_elapsed;
+	// pending field refreshes, merged until the next FlushRefresh
+	int refresh_flag[2][5];
+	int refresh_cache[2][5];
+	// last update per location for the owning side [0] and the masked [1] viewers
+	FieldDelta field_view[2][5][2];
 };
 
 }
@@ -5,6 +5,15 @@ solution "ygo"
 
     configurations { "Debug", "Release" }
 
+    newoption
+    {
+        trigger = "startup-profile-allocs",
+        description = "Count heap allocations in the --profile-startup report"
+    }
+    if _OPTIONS["startup-profile-allocs"] then
+        defines { "YGOPRO_STARTUP_PROFILE_ALLOCS" }
+    end
+
     configuration "windows"
         defines { "WIN32", "_WIN32", "WINVER=0x0501" }
 